@@ -18,6 +18,21 @@
 	typedef float Float;
 #endif
 
+//SIMD paths for AffineMatrix: AVX for double, SSE2 for double without AVX (baseline on
+//x64), SSE for float. Define HSM_NO_SIMD to force the scalar code.
+#if !defined(HSM_NO_SIMD)
+#if defined(USE_DOUBLE) && defined(__AVX__)
+#define HSM_SIMD_AVX
+#include <immintrin.h>
+#elif defined(USE_DOUBLE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HSM_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(USE_DOUBLE) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define HSM_SIMD_SSE
+#include <xmmintrin.h>
+#endif
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning(disable : 4305)
 #pragma warning(disable : 4244)
@@ -727,9 +742,7 @@ inline Point3f RandomPoint() {
 	return Point3f(Random<Float>(), Random<Float>(), Random<Float>());
 }
 
-inline Vector3f RandomCosineDirection() {
-	auto r1 = Random<Float>();
-	auto r2 = Random<Float>();
+inline Vector3f RandomCosineDirection(Float r1, Float r2) {
 	auto z = sqrt(1 - r2);
 	auto phi = 2 * Pi*r1;
 	auto x = cos(phi)*sqrt(r2);
@@ -738,9 +751,11 @@ inline Vector3f RandomCosineDirection() {
 	return Vector3f(x, y, z);
 }
 
-inline Vector3f Random2Sphere(double radius, double distanceSquared) {
-	auto r1 = Random<Float>();
-	auto r2 = Random<Float>();
+inline Vector3f RandomCosineDirection() {
+	return RandomCosineDirection(Random<Float>(), Random<Float>());
+}
+
+inline Vector3f Random2Sphere(double radius, double distanceSquared, Float r1, Float r2) {
 	auto z = 1 + r2 * (sqrt(1 - radius * radius / distanceSquared) - 1);
 
 	auto phi = 2 * Pi*r1;
@@ -750,6 +765,26 @@ inline Vector3f Random2Sphere(double radius, double distanceSquared) {
 	return Vector3f(x, y, z);
 }
 
+inline Vector3f Random2Sphere(double radius, double distanceSquared) {
+	return Random2Sphere(radius, distanceSquared, Random<Float>(), Random<Float>());
+}
+
+//Shirley-Chiu concentric mapping, keeps the stratification of u
+inline Vector2f ConcentricSampleDisk(const Point2f& u) {
+	Float ox = 2 * u.x - 1, oy = 2 * u.y - 1;
+	if (ox == 0 && oy == 0) return Vector2f(0, 0);
+	Float r, theta;
+	if (std::abs(ox) > std::abs(oy)) {
+		r = ox;
+		theta = Pi / 4 * (oy / ox);
+	}
+	else {
+		r = oy;
+		theta = Pi / 2 - Pi / 4 * (ox / oy);
+	}
+	return Vector2f(r * std::cos(theta), r * std::sin(theta));
+}
+
 typedef Vector3<Float> Color;
 
 inline Color operator * (const Color& c1, const Color& c2) {
@@ -1189,6 +1224,99 @@ inline Ray Matrix4x4::operator()(const Ray &r) const {
 	return Ray(o, d, r.time);
 }
 
+//Affine matrix, the bottom row is implicitly (0, 0, 0, 1). Stored as four padded columns
+//so a point transforms as c0 * x + c1 * y + c2 * z + c3, which is three multiplies and
+//three adds on whole columns with SIMD. The scalar fallback still skips the homogeneous
+//row and divide of Matrix4x4.
+class AffineMatrix {
+public:
+	AffineMatrix() : AffineMatrix(Matrix4x4()) {}
+	explicit AffineMatrix(const Matrix4x4& mat) {
+		for (int j = 0; j < 4; ++j) {
+			for (int i = 0; i < 3; ++i) columns[j][i] = mat.data[i][j];
+			columns[j][3] = 0;
+		}
+	}
+
+	Matrix4x4 ToMatrix4x4() const {
+		return Matrix4x4(columns[0][0], columns[1][0], columns[2][0], columns[3][0],
+			             columns[0][1], columns[1][1], columns[2][1], columns[3][1],
+			             columns[0][2], columns[1][2], columns[2][2], columns[3][2],
+			             0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	inline Float operator()(int row, int column) const { return columns[column][row]; }
+
+	inline Point3f operator()(const Point3f& p) const { return Point3f(Apply(p.x, p.y, p.z, true)); }
+	inline Vector3f operator()(const Vector3f& v) const { return Apply(v.x, v.y, v.z, false); }
+	inline Ray operator()(const Ray& r) const { return Ray((*this)(r.origin), (*this)(r.direction), r.time); }
+
+private:
+	inline Vector3f Apply(Float x, Float y, Float z, bool translate) const;
+
+public:
+	alignas(32) Float columns[4][4];
+};
+
+#if defined(HSM_SIMD_AVX)
+inline Vector3f AffineMatrix::Apply(Float x, Float y, Float z, bool translate) const {
+	__m256d r = translate ? _mm256_load_pd(columns[3]) : _mm256_setzero_pd();
+#if defined(__FMA__)
+	r = _mm256_fmadd_pd(_mm256_load_pd(columns[0]), _mm256_set1_pd(x), r);
+	r = _mm256_fmadd_pd(_mm256_load_pd(columns[1]), _mm256_set1_pd(y), r);
+	r = _mm256_fmadd_pd(_mm256_load_pd(columns[2]), _mm256_set1_pd(z), r);
+#else
+	r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_load_pd(columns[0]), _mm256_set1_pd(x)));
+	r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_load_pd(columns[1]), _mm256_set1_pd(y)));
+	r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_load_pd(columns[2]), _mm256_set1_pd(z)));
+#endif
+	alignas(32) double out[4];
+	_mm256_store_pd(out, r);
+	return Vector3f(out[0], out[1], out[2]);
+}
+#elif defined(HSM_SIMD_SSE2)
+//A double column does not fit one register: x and y go packed, z with scalar operations,
+//and the packed pair is stored straight into the result. The sums start from the first
+//product, adding a zero translation would not fold away for vectors.
+inline Vector3f AffineMatrix::Apply(Float x, Float y, Float z, bool translate) const {
+	__m128d s = _mm_set1_pd(x);
+	__m128d xy = _mm_mul_pd(_mm_load_pd(columns[0]), s);
+	__m128d zz = _mm_mul_sd(_mm_load_sd(columns[0] + 2), s);
+	s = _mm_set1_pd(y);
+	xy = _mm_add_pd(xy, _mm_mul_pd(_mm_load_pd(columns[1]), s));
+	zz = _mm_add_sd(zz, _mm_mul_sd(_mm_load_sd(columns[1] + 2), s));
+	s = _mm_set1_pd(z);
+	xy = _mm_add_pd(xy, _mm_mul_pd(_mm_load_pd(columns[2]), s));
+	zz = _mm_add_sd(zz, _mm_mul_sd(_mm_load_sd(columns[2] + 2), s));
+	if (translate) {
+		xy = _mm_add_pd(xy, _mm_load_pd(columns[3]));
+		zz = _mm_add_sd(zz, _mm_load_sd(columns[3] + 2));
+	}
+	Vector3f r;
+	_mm_storeu_pd(&r.x, xy);
+	r.z = _mm_cvtsd_f64(zz);
+	return r;
+}
+#elif defined(HSM_SIMD_SSE)
+inline Vector3f AffineMatrix::Apply(Float x, Float y, Float z, bool translate) const {
+	__m128 r = translate ? _mm_load_ps(columns[3]) : _mm_setzero_ps();
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(columns[0]), _mm_set1_ps(x)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(columns[1]), _mm_set1_ps(y)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(columns[2]), _mm_set1_ps(z)));
+	alignas(16) float out[4];
+	_mm_store_ps(out, r);
+	return Vector3f(out[0], out[1], out[2]);
+}
+#else
+inline Vector3f AffineMatrix::Apply(Float x, Float y, Float z, bool translate) const {
+	Vector3f r(columns[0][0] * x + columns[1][0] * y + columns[2][0] * z,
+		       columns[0][1] * x + columns[1][1] * y + columns[2][1] * z,
+		       columns[0][2] * x + columns[1][2] * y + columns[2][2] * z);
+	if (translate) r += Vector3f(columns[3][0], columns[3][1], columns[3][2]);
+	return r;
+}
+#endif
+
 //Quaternion
 class Quaternion {
 public:
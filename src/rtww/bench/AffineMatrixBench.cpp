@@ -0,0 +1,56 @@
+//Micro-benchmark of the point and vector transforms: Matrix4x4 against AffineMatrix with
+//whatever SIMD path the build selects. Build it on its own from src/rtww, e.g.
+//	g++ -O2 -I. -I../ext/hsm bench/AffineMatrixBench.cpp				(SSE2 double path)
+//	g++ -O2 -mavx2 -mfma -I. -I../ext/hsm bench/AffineMatrixBench.cpp	(AVX double path)
+//	g++ -O2 -DHSM_NO_SIMD -I. -I../ext/hsm bench/AffineMatrixBench.cpp	(scalar path)
+//and add -DRTWW_SINGLE_PRECISION for the float paths.
+#include <cstring>
+#include "core/Core.hpp"
+#include <chrono>
+#include <cstdio>
+
+static const char* SimdPath() {
+#if defined(HSM_SIMD_AVX)
+	return "AVX";
+#elif defined(HSM_SIMD_SSE2)
+	return "SSE2";
+#elif defined(HSM_SIMD_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+//Runs transform over every point repeat times into out, so iterations stay independent
+//and the time is that of the transform. The checksum keeps the compiler from dropping it.
+template <typename Function>
+static void Measure(const char* name, const std::vector<Point3f>& points, int repeat, Function transform) {
+	std::vector<Vector3f> out(points.size());
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < repeat; ++k)
+		for (size_t i = 0; i < points.size(); ++i) {
+			auto q = transform(points[i]);
+			out[i] = Vector3f(q.x, q.y, q.z);
+		}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	Float sum = 0;
+	for (const auto& q : out) sum += q.x + q.y + q.z;
+	printf("%-24s %6.2f ns per transform  (checksum %g)\n", name, seconds * 1e9 / (double(points.size()) * repeat), double(sum));
+}
+
+int main() {
+	auto object2World = Translate(Vector3f(1, -2, 3)) * CreateQuaternionByVec3(Vector3f(30, 45, 60)).ToMatrix4x4() * Scale(Vector3f(2, 3, 4));
+	AffineMatrix affine(object2World);
+
+	//16K points stay in L1/L2, the loop measures arithmetic rather than memory
+	std::vector<Point3f> points(1 << 14);
+	for (auto& p : points) p = Point3f(Random<Float>(), Random<Float>(), Random<Float>());
+	const int repeat = 2000;
+
+	printf("%s Float, AffineMatrix path: %s\n", sizeof(Float) == 8 ? "double" : "float", SimdPath());
+	Measure("Matrix4x4 point", points, repeat, [&](const Point3f& p) { return object2World(p); });
+	Measure("AffineMatrix point", points, repeat, [&](const Point3f& p) { return affine(p); });
+	Measure("Matrix4x4 vector", points, repeat, [&](const Point3f& p) { return object2World(Convert(p)); });
+	Measure("AffineMatrix vector", points, repeat, [&](const Point3f& p) { return affine(Convert(p)); });
+	return 0;
+}
@@ -0,0 +1,65 @@
+//Micro-benchmark of ImageTexture lookups: nearest Value and filtered FilteredValue, with
+//random texture coordinates and with coherent ones sweeping the image row by row the way
+//neighbouring camera rays do. Build it on its own from src/rtww, e.g.
+//	g++ -O2 -std=c++17 -I. -I../ext/hsm -I../ext/stb_image bench/ImageTextureBench.cpp -lpthread
+//and run it with an image file, the larger the better, e.g. resources/earthmap.jpg.
+#include <cstring>
+#include "core/Texture.hpp"
+#include <chrono>
+#include <cstdio>
+
+//Looks every coordinate up repeat times, the sum keeps the compiler from dropping it.
+template <typename Lookup>
+static void Measure(const char* name, const std::vector<Point2f>& coordinates, int repeat, Lookup lookup) {
+	Color sum;
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < repeat; ++k)
+		for (const auto& uv : coordinates) sum += lookup(uv);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-28s %6.2f ns per lookup  (checksum %g)\n", name, seconds * 1e9 / (double(coordinates.size()) * repeat), double(sum.x + sum.y + sum.z));
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <image file>\n";
+		return 1;
+	}
+	const char* fileName = argv[1];
+	int width, height, components;
+	if (!stbi_info(fileName, &width, &height, &components)) {
+		std::cerr << "Fail to open " << fileName << "\n";
+		return 1;
+	}
+	ImageTexture texture(fileName);
+
+	const int count = 1 << 20;
+	std::vector<Point2f> random(count), coherent(count);
+	for (auto& uv : random) uv = Point2f(Random<Float>(), Random<Float>());
+	//a quarter texel apart along rows, as a camera a little closer than one texel per pixel
+	for (int k = 0; k < count; ++k) {
+		Float x = 0.25f * k + 0.5f;
+		int row = static_cast<int>(x / width);
+		coherent[k] = Point2f((x - Float(row) * width) / width, 1 - (row % height + 0.5f) / height);
+	}
+
+	IntersectionRecord rec;		//no differentials: the full size level, bilinear
+	IntersectionRecord minified;
+	minified.dudx = minified.dvdy = 6.0f / width;	//between mip levels 2 and 3, trilinear
+	printf("%s, %d x %d\n", fileName, width, height);
+	for (int pass = 0; pass < 2; ++pass) {
+		const auto& coordinates = pass == 0 ? random : coherent;
+		printf("%s coordinates\n", pass == 0 ? "random" : "coherent");
+		Measure("  Value (nearest)", coordinates, 4, [&](const Point2f& uv) { return texture.Value(uv.x, uv.y, Point3f()); });
+		Measure("  FilteredValue (bilinear)", coordinates, 4, [&](const Point2f& uv) {
+			rec.u = uv.x;
+			rec.v = uv.y;
+			return texture.FilteredValue(rec);
+		});
+		Measure("  FilteredValue (trilinear)", coordinates, 4, [&](const Point2f& uv) {
+			minified.u = uv.x;
+			minified.v = uv.y;
+			return texture.FilteredValue(minified);
+		});
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+//Benchmark of the Float precision: the size of the core types and of a mesh, and the time
+//to trace a fixed set of rays through a BVH of triangles and spheres. Build it on its own
+//from src/rtww once per precision, e.g.
+//	g++ -O2 -std=c++17 -I. -I../ext/hsm bench/PrecisionBench.cpp							(double)
+//	g++ -O2 -std=c++17 -DRTWW_SINGLE_PRECISION -I. -I../ext/hsm bench/PrecisionBench.cpp	(float)
+//and compare the two outputs, the hit count shows how far the precisions disagree.
+#include <cstring>
+#include <memory>
+#include "core/BVH.hpp"
+#include "shape/Sphere.hpp"
+#include "shape/Triangle.hpp"
+#include <chrono>
+#include <cstdio>
+
+//A bumpy sphere of radius about 8 with n rings of 2n segments, with normals and uvs. It has
+//extent along every axis, which the random split axis of BVHNode needs to stay balanced.
+static MeshData CreateBall(int n) {
+	MeshData data;
+	for (int j = 0; j <= n; ++j)
+		for (int i = 0; i <= 2 * n; ++i) {
+			Float u = Float(i) / (2 * n), v = Float(j) / n;
+			Float phi = 2 * Pi * u, theta = Pi * v;
+			Vector3f normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			Float radius = 8 + 0.25f * std::sin(24 * u) * std::cos(16 * v);
+			data.vertices.push_back(Point3f(radius * normal.x, radius * normal.y, radius * normal.z));
+			data.normals.push_back(normal);
+			data.uvs.push_back(Point2f(u, v));
+		}
+	for (int j = 0; j < n; ++j)
+		for (int i = 0; i < 2 * n; ++i) {
+			int v0 = j * (2 * n + 1) + i, v1 = v0 + 1, v2 = v0 + 2 * n + 1, v3 = v2 + 1;
+			data.indices.insert(data.indices.end(), { v0, v1, v2, v1, v3, v2 });
+		}
+	return data;
+}
+
+int main() {
+	auto ball = CreateBall(64);
+	size_t meshBytes = ball.vertices.size() * sizeof(Point3f) + ball.normals.size() * sizeof(Vector3f)
+		+ ball.uvs.size() * sizeof(Point2f) + ball.indices.size() * sizeof(int);
+	auto mesh = std::make_shared<Mesh>(std::make_shared<Transform>(Point3f(0, 0, 0), Vector3f(1, 1, 1), Vector3f(0, 0, 0)), std::move(ball), nullptr);
+
+	auto objects = GetMeshTriangles(mesh);
+	size_t triangles = objects.size();
+	//a ring of analytic spheres around the ball
+	for (int k = 0; k < 64; ++k) {
+		Float phi = 2 * Pi * k / 64;
+		objects.push_back(CreateSphere(Point3f(11 * std::cos(phi), 0, 11 * std::sin(phi)), Vector3f(1, 1, 1), Vector3f(0, 0, 0), nullptr));
+	}
+	BVHNode world(objects, 0, objects.size(), 0, 1);
+
+	//a camera in front of the ball and its ring aiming at a fixed 512 x 256 grid, so both
+	//precisions trace the same rays
+	std::vector<Ray> rays;
+	Point3f eye(0, 6, -30);
+	for (int j = 0; j < 256; ++j)
+		for (int i = 0; i < 512; ++i)
+			rays.push_back(Ray(eye, Point3f(26 * (i + 0.5f) / 512 - 13, 26 * (j + 0.5f) / 256 - 13, 0) - eye));
+
+	printf("%s Float\n", sizeof(Float) == 8 ? "double" : "float");
+	printf("  sizeof Float %zu, Vector3f %zu, Point3f %zu, Ray %zu, AABB %zu, Transform %zu, IntersectionRecord %zu\n",
+		sizeof(Float), sizeof(Vector3f), sizeof(Point3f), sizeof(Ray), sizeof(AABB), sizeof(Transform), sizeof(IntersectionRecord));
+	printf("  mesh: %zu triangles, %zu vertices, %.2f MB of buffers, %.2f MB of BVH nodes\n",
+		triangles, size_t(mesh->verticesNum), meshBytes / 1048576.0, (objects.size() - 1) * sizeof(BVHNode) / 1048576.0);
+
+	//the best of a few runs, the hit count and depth sum keep the compiler from dropping the loop
+	double best = 1e30;
+	size_t hits = 0;
+	Float depth = 0;
+	for (int run = 0; run < 5; ++run) {
+		hits = 0;
+		depth = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (const auto& r : rays) {
+			IntersectionRecord rec;
+			if (world.Intersection(r, 0.001f, Infinity, rec)) {
+				++hits;
+				depth += rec.time;
+			}
+		}
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	printf("  %zu rays, %zu hits, %6.1f ns per ray  (checksum %g)\n", rays.size(), hits, best * 1e9 / rays.size(), double(depth));
+	return 0;
+}
@@ -12,6 +12,12 @@ public:
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override;
+	virtual void IntersectionPacket(const RayPacket& packet, Float tMin, uint32_t active, PacketHits& hits) const override;
+	virtual void GetChildren(std::vector<std::shared_ptr<Shape>>& children) const override {
+		children.push_back(leftChild);
+		//single object leaves point both children at it
+		if (rightChild != leftChild) children.push_back(rightChild);
+	}
 
 public:
 	std::shared_ptr<Shape> leftChild;
@@ -85,6 +91,20 @@ bool BVHNode::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRe
 	return left || right;
 }
 
+//The packet descends as long as any of its rays still hits the node, carrying the
+//mask of those rays so the children only test them.
+void BVHNode::IntersectionPacket(const RayPacket& packet, Float tMin, uint32_t active, PacketHits& hits) const {
+	if (packet.Misses(boundingBox, tMin, hits.MaxDistance(packet.size, active))) return;
+
+	uint32_t inside = 0;
+	for (int i = 0; i < packet.size; ++i)
+		if (((active >> i) & 1) && packet.Hits(i, boundingBox, tMin, hits.tMax[i])) inside |= 1u << i;
+	if (!inside) return;
+
+	leftChild->IntersectionPacket(packet, tMin, inside, hits);
+	if (rightChild != leftChild) rightChild->IntersectionPacket(packet, tMin, inside, hits);
+}
+
 bool BVHNode::BoundingBox(Float time0, Float time1, AABB& outputBox) const {
 	outputBox = boundingBox;
 	return true;
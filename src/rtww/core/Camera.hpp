@@ -9,7 +9,7 @@ public:
 		auto theta = Radians(vFov);
 		auto h = tan(theta / 2);
 		auto viewportHeight = 2.0 * h;
-		double viewportWidth = aspectRatio * viewportHeight;
+		Float viewportWidth = aspectRatio * viewportHeight;
 
 		dir = (lookFrom - lookAt).Normalize();
 		right = Cross(vUp, dir).Normalize();
@@ -30,6 +30,24 @@ public:
 		return Ray(origin + offset, lowerLeftCorner + u * horizontal + v * vectical - origin - offset);
 	}
 
+	//lensSample in [0,1)^2, mapped onto the aperture
+	Ray GenerateRay(Float u, Float v, const Point2f& lensSample) const {
+		Vector2f disk = lenRadius * ConcentricSampleDisk(lensSample);
+		Vector3f offset = right * disk.x + up * disk.y;
+
+		return Ray(origin + offset, lowerLeftCorner + u * horizontal + v * vectical - origin - offset);
+	}
+
+	//Differentials of a ray from GenerateRay to the rays through the same lens point at
+	//u + du and v + dv.
+	RayDifferential GenerateDifferential(const Ray& r, Float du, Float dv) const {
+		RayDifferential differential;
+		differential.rxOrigin = differential.ryOrigin = r.origin;
+		differential.rxDirection = r.direction + du * horizontal;
+		differential.ryDirection = r.direction + dv * vectical;
+		return differential;
+	}
+
 public:
 	Point3f origin;
 	Vector3f horizontal;
@@ -1,10 +1,40 @@
 #pragma once
 
+//Float is double unless the build defines RTWW_SINGLE_PRECISION, which halves the size
+//of every vector, matrix and mesh vertex.
+#ifndef RTWW_SINGLE_PRECISION
 #define USE_DOUBLE
+#endif
 #include "hsm.hpp"
 using namespace hsm;
 #include <vector>
 
+inline Float Luminance(const Color& c) {
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+inline bool IsBlack(const Color& c) { return c.x <= 0 && c.y <= 0 && c.z <= 0; }
+
+//Relative error bound of a computed hit point. Hits go through an object space
+//transform and back, so allow a few dozen ulps.
+static constexpr Float RayOriginErrorScale = 64 * std::numeric_limits<Float>::epsilon();
+
+//Moves p off the surface with normal n, to the side direction w leaves towards, by the
+//error bound of p. The bound grows with |p|, unlike a fixed tMin, so single precision
+//builds do not self intersect on large scenes.
+inline Point3f OffsetRayOrigin(const Point3f& p, const Vector3f& n, const Vector3f& w) {
+	Float magnitude = std::max({ std::abs(p.x), std::abs(p.y), std::abs(p.z), Float(1) });
+	Vector3f offset = (RayOriginErrorScale * magnitude) * n;
+	return Dot(w, n) < 0 ? p - offset : p + offset;
+}
+
+//Rays through the points one pixel to the right (x) and one pixel up (y) of a camera
+//ray, they size the texture filter at the first hit.
+struct RayDifferential {
+	Point3f rxOrigin, ryOrigin;
+	Vector3f rxDirection, ryDirection;
+};
+
 Vector3i ConvertColor(const Color& c, int samples) {
 	auto r = c.x;
 	auto g = c.y;
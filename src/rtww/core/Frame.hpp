@@ -4,40 +4,130 @@
 #include "core/Camera.hpp"
 
 #include <thread>
-#include <Windows.h>
-#include <sstream>
+#include <chrono>
 #include "core/ThreadPool.h"
+#include "core/Progress.hpp"
 #include "core/File.hpp"
 #include "core/Image.hpp"
+#include "core/Framebuffer.hpp"
+#include "core/Sampler.hpp"
+#include "core/LightSampler.hpp"
 #include "gif.h"
 
+//Per-pixel adaptive sampling within the frame's budget of samplesPerPixel per pixel on
+//average: pixels are sampled in batches until the relative standard error of their
+//luminance drops below errorThreshold. Converged pixels stop at minSamples and leave the
+//rest of their share to the noisy ones, which may take up to maxSamples each.
+struct AdaptiveSettings {
+	bool enabled = false;
+	Float errorThreshold = 0.02f;
+	uint32_t minSamples = 32;
+	uint32_t maxSamples = 0;
+	uint32_t batchSize = 16;
+};
+
 struct FrameSettings {
 	std::shared_ptr<Camera> camera;
 	std::shared_ptr<ShapesSet> objects;
 	std::shared_ptr<ShapesSet> lights;
+	std::shared_ptr<LightSampler> lightSampler;
+	LightSelection lightSelection = LightSelection::BVH;
 	Color backgroundColor;
 
 	uint16_t imageWidth, imageHeight;
+	uint32_t aovs = AOV_None;
 	uint32_t rayTracingDepth, samplesPerPixel;
+	uint32_t russianRouletteDepth = 0;
+	SamplerType samplerType = SamplerType::Independent;
+	uint32_t samplerSeed = 0;
+	AdaptiveSettings adaptive;
+	std::vector<uint32_t> adaptiveTargets;	//sample count per pixel to reach this round, see RenderAdaptive
+	FrameProgress progress;
+	std::shared_ptr<Framebuffer> framebuffer;
 
-	void SetImageOptions(uint16_t width, uint16_t height) {
+	void SetImageOptions(uint16_t width, uint16_t height, uint32_t aovFlags = AOV_None) {
 		imageWidth = width;
 		imageHeight = height;
+		aovs = aovFlags;
+	}
+
+	//Lights are found in obj from their DiffuseLight materials when the frame renders.
+	void SetScene(std::shared_ptr<Camera> cam, std::shared_ptr<ShapesSet> obj, const Color& bgColor) {
+		SetScene(cam, obj, nullptr, bgColor);
 	}
 
+	//lig overrides the automatic light list, every shape in it is sampled with its area as power.
 	void SetScene(std::shared_ptr<Camera> cam, std::shared_ptr<ShapesSet> obj, std::shared_ptr<ShapesSet> lig, const Color& bgColor) {
 		camera = cam;
 		objects = obj;
 		lights = lig;
+		lightSampler.reset();
 		backgroundColor = bgColor;
 	}
 
-	void SetRayTraceOptions(uint32_t depth, uint32_t samples) {
+	//rouletteDepth is the number of bounces before Russian roulette starts, 0 disables it
+	void SetRayTraceOptions(uint32_t depth, uint32_t samples, uint32_t rouletteDepth = 0) {
 		rayTracingDepth = depth;
 		samplesPerPixel = samples;
+		russianRouletteDepth = rouletteDepth;
+	}
+
+	void SetLightOptions(LightSelection selection) {
+		lightSelection = selection;
+		lightSampler.reset();
+	}
+
+	//Called by FrameRenderer before the frame renders, after all options are set.
+	void BuildLightSampler() {
+		if (lightSampler) return;
+		if (lights) {
+			lightSampler = std::make_shared<LightSampler>(*lights, lightSelection);
+			return;
+		}
+		lightSampler = std::make_shared<LightSampler>();
+		if (objects) lightSampler->AddSceneLights(objects);
+		lightSampler->Build(lightSelection);
+	}
+
+	void SetSamplerOptions(SamplerType type, uint32_t seed = 0) {
+		samplerType = type;
+		samplerSeed = seed;
+	}
+
+	//maxSamples of 0 lets a noisy pixel take up to four times samplesPerPixel, the frame as a
+	//whole never takes more than samplesPerPixel per pixel
+	void SetAdaptiveOptions(Float errorThreshold, uint32_t minSamples, uint32_t maxSamples = 0, uint32_t batchSize = 16) {
+		adaptive.enabled = true;
+		adaptive.errorThreshold = errorThreshold;
+		adaptive.minSamples = minSamples;
+		adaptive.maxSamples = maxSamples;
+		adaptive.batchSize = batchSize > 0 ? batchSize : 1;
+	}
+
+	uint32_t MaxAdaptiveSamples() const {
+		return adaptive.maxSamples > 0 ? adaptive.maxSamples : 4 * samplesPerPixel;
 	}
+
+	//Differentials of a camera ray to the neighbouring pixels, narrowed as the samples per
+	//pixel grow since the samples already average over the pixel.
+	RayDifferential CameraDifferential(const Ray& r) const {
+		Float scale = std::max<Float>(0.125f, 1 / std::sqrt(Float(std::max<uint32_t>(samplesPerPixel, 1))));
+		return camera->GenerateDifferential(r, scale / (imageWidth - 1), scale / (imageHeight - 1));
+	}
+};
+
+//Renders the whole image in passes of samplesPerPass until targetSamples per pixel
+//(the frame's samplesPerPixel when 0) or the wall-clock budget is reached.
+struct ProgressiveSettings {
+	bool enabled = false;
+	uint32_t samplesPerPass = 16;
+	uint32_t targetSamples = 0;
+	Float timeBudget = 0;	//seconds, 0 means no limit
+	bool writeIntermediate = true;
 };
 
+typedef void(*DrawFunction)(int line, uint32_t samples, std::shared_ptr<FrameSettings> settings);
+
 class FrameRenderer {
 public:
 	FrameRenderer(const char* name, const fs::path& path, uint32_t frameRate, uint16_t count) 
@@ -50,7 +140,24 @@ public:
 	}
 
 	void AddFrame(std::shared_ptr<FrameSettings> frame) { frames.emplace_back(frame); }
-	void Render(std::vector<Color>(*Draw)(int, std::shared_ptr<FrameSettings>), uint32_t startIndex = 0, uint32_t endIndex = 0);
+	void SetProgressOptions(ProgressMode mode, uint32_t intervalMs) {
+		reporter.mode = mode;
+		reporter.intervalMs = intervalMs;
+	}
+	void SetProgressiveOptions(uint32_t samplesPerPass, Float timeBudget, uint32_t targetSamples = 0, bool writeIntermediate = true) {
+		progressive.enabled = true;
+		progressive.samplesPerPass = samplesPerPass > 0 ? samplesPerPass : 1;
+		progressive.timeBudget = timeBudget;
+		progressive.targetSamples = targetSamples;
+		progressive.writeIntermediate = writeIntermediate;
+	}
+	void Render(DrawFunction Draw, uint32_t startIndex = 0, uint32_t endIndex = 0);
+
+private:
+	void RenderPass(DrawFunction Draw, std::shared_ptr<FrameSettings> frame, uint32_t samples);
+	uint32_t RenderProgressive(DrawFunction Draw, uint32_t index, std::chrono::steady_clock::time_point start);
+	void RenderAdaptive(DrawFunction Draw, std::shared_ptr<FrameSettings> frame);
+	void WriteImage(std::shared_ptr<FrameSettings> frame, const fs::path& filePath, uint8_t* data);
 
 public:
 	fs::path path;
@@ -59,65 +166,152 @@ public:
 	uint16_t threadCount;
 	std::vector<std::shared_ptr<FrameSettings>> frames;
 	std::shared_ptr<ThreadPool> pool;
+	ProgressReporter reporter;
+	ProgressiveSettings progressive;
 };
-std::mutex consoleMutex;
 
-void FrameRenderer::Render(std::vector<Color>(*Draw)(int, std::shared_ptr<FrameSettings>), uint32_t startIndex, uint32_t endIndex) {
+void FrameRenderer::RenderPass(DrawFunction Draw, std::shared_ptr<FrameSettings> frame, uint32_t samples) {
+	std::vector<std::future<void>> result(frame->imageHeight);
+	for (int j = frame->imageHeight - 1; j >= 0; --j) {
+		result[j] = pool->enqueue(Draw, j, samples, frame);
+	}
+	for (int j = frame->imageHeight - 1; j >= 0; --j) {
+		result[j].get();
+	}
+}
+
+//Spends exactly the budget of samplesPerPixel per pixel, or less when everything
+//converges: every pixel first takes minSamples, then each round hands what is left to
+//the pixels that have not converged in proportion to their error. A pixel stops early
+//when it converges within its share, the next round measures the errors again and
+//hands out what such pixels left.
+void FrameRenderer::RenderAdaptive(DrawFunction Draw, std::shared_ptr<FrameSettings> frame) {
+	const auto& adaptive = frame->adaptive;
+	const auto& fb = *frame->framebuffer;
+	auto maxSamples = frame->MaxAdaptiveSamples();
+	size_t pixelCount = size_t(frame->imageWidth) * frame->imageHeight;
+	uint64_t budget = uint64_t(pixelCount) * frame->samplesPerPixel;
+	//progress of the rounds is counted in samples against the budget
+	frame->progress.Reset(budget);
+
+	frame->adaptiveTargets.assign(pixelCount, std::min({ adaptive.minSamples, frame->samplesPerPixel, maxSamples }));
+	RenderPass(Draw, frame, 0);
+
+	std::vector<Float> errors(pixelCount);
+	for (uint64_t used = fb.TotalSamples(); used < budget; used = fb.TotalSamples()) {
+		Float errorSum = 0;
+		size_t open = 0;
+		for (int y = 0; y < frame->imageHeight; ++y) {
+			for (int x = 0; x < frame->imageWidth; ++x) {
+				auto p = size_t(y) * frame->imageWidth + x;
+				Float error = fb.SampleCount(x, y) < maxSamples ? fb.RelativeError(x, y) : 0;
+				//capped, a pixel with one sample or a firefly would take the whole round
+				errors[p] = error >= adaptive.errorThreshold ? std::min<Float>(error, 1) : 0;
+				errorSum += errors[p];
+				open += errors[p] > 0;
+			}
+		}
+		if (open == 0) break;
+
+		auto round = budget - used;
+		uint64_t handedOut = 0;
+		for (int y = 0; y < frame->imageHeight; ++y) {
+			for (int x = 0; x < frame->imageWidth; ++x) {
+				auto p = size_t(y) * frame->imageWidth + x;
+				auto n = fb.SampleCount(x, y);
+				auto share = std::min<uint64_t>(static_cast<uint64_t>(round * (errors[p] / errorSum)), maxSamples - n);
+				frame->adaptiveTargets[p] = n + static_cast<uint32_t>(share);
+				handedOut += share;
+			}
+		}
+		if (handedOut == 0) break;
+		RenderPass(Draw, frame, 0);
+	}
+	frame->adaptiveTargets.clear();
+}
+
+//Returns the samples per pixel actually reached.
+uint32_t FrameRenderer::RenderProgressive(DrawFunction Draw, uint32_t index, std::chrono::steady_clock::time_point start) {
+	auto& frame = frames[index];
+	auto target = progressive.targetSamples > 0 ? progressive.targetSamples : frame->samplesPerPixel;
+	auto passes = (target + progressive.samplesPerPass - 1) / progressive.samplesPerPass;
+	frame->progress.Reset(uint64_t(frame->imageHeight) * passes);
+	std::unique_ptr<uint8_t[]> data;
+
+	uint32_t done = 0;
+	for (uint32_t pass = 0; done < target; ++pass) {
+		auto samples = std::min(progressive.samplesPerPass, target - done);
+		RenderPass(Draw, frame, samples);
+		done += samples;
+
+		Float elapsed = std::chrono::duration<Float>(std::chrono::steady_clock::now() - start).count();
+		bool outOfTime = progressive.timeBudget > 0 && elapsed >= progressive.timeBudget;
+		if (outOfTime || done >= target) break;
+
+		if (progressive.writeIntermediate) {
+			if (!data) data.reset(new uint8_t[size_t(frame->imageWidth) * frame->imageHeight * 4]);
+			frame->framebuffer->Resolve(data.get(), 4);
+			WriteImage(frame, path / (name + "-Frame" + std::to_string(index) + "-Pass" + std::to_string(pass) + ".jpg"), data.get());
+		}
+	}
+	return done;
+}
+
+void FrameRenderer::WriteImage(std::shared_ptr<FrameSettings> frame, const fs::path& filePath, uint8_t* data) {
+	Image::Write2JPG(filePath.string().c_str(), (const char*)data, frame->imageWidth, frame->imageHeight, 100, 4);
+}
+
+void FrameRenderer::Render(DrawFunction Draw, uint32_t startIndex, uint32_t endIndex) {
 	endIndex = endIndex == 0 ? frames.size() : endIndex;
-	DWORD totalTime = 0;
+	Float totalTime = 0;
 
 	auto gifRate = 100.0f / frameRate;
 	GifWriter writer = {};
 	GifBegin(&writer, (path / (name + ".gif")).string().c_str(), frames[startIndex]->imageWidth, frames[startIndex]->imageHeight, gifRate, 8, true);
 	
 	for (uint32_t index = startIndex; index < endIndex; ++index) {
+		auto& frame = frames[index];
 		pool = std::make_shared<ThreadPool>(threadCount);
-		consoleMutex.lock();
-		std::cerr << "The frame " << index + 1 << " starts rendering.\n" << std::flush;
-		consoleMutex.unlock();
-		DWORD start = ::GetTickCount();
-		std::stringstream ss;
-
-		std::vector<std::vector<Color>> pixels(frames[index]->imageHeight, std::vector<Color>(frames[index]->imageWidth, Color(0, 0, 0)));
-		std::vector<std::future<std::vector<Color>>> result(frames[index]->imageHeight);
-		for (int j = frames[index]->imageHeight - 1; j >= 0; --j) {
-			result[j] = pool->enqueue(Draw, j, frames[index]);
-		}
-		for (int j = frames[index]->imageHeight - 1; j >= 0; --j) {
-			pixels[j] = result[j].get();
+		auto start = std::chrono::steady_clock::now();
+		frame->framebuffer = std::make_shared<Framebuffer>(frame->imageWidth, frame->imageHeight,
+			frame->aovs | (frame->adaptive.enabled ? AOV_Variance : AOV_None));
+		frame->BuildLightSampler();
+		frame->progress.Reset(frame->imageHeight);
+		reporter.Start(index + 1, &frame->progress);
+
+		uint32_t samplesPerPixel = frame->samplesPerPixel;
+		if (progressive.enabled)
+			samplesPerPixel = RenderProgressive(Draw, index, start);
+		else if (frame->adaptive.enabled)
+			RenderAdaptive(Draw, frame);
+		else
+			RenderPass(Draw, frame, frame->samplesPerPixel);
+
+		if (frame->adaptive.enabled) {
+			uint64_t budget = uint64_t(frame->imageWidth) * frame->imageHeight * samplesPerPixel;
+			reporter.ReportSampling(index + 1, frame->framebuffer->TotalSamples(), budget);
 		}
-		uint8_t* data = new uint8_t[frames[index]->imageHeight*frames[index]->imageWidth*4];
-		for (int j = frames[index]->imageHeight - 1; j >= 0; --j) {
-			for (int i = 0; i < frames[index]->imageWidth; ++i) {
-				auto c = ConvertColor(pixels[j][i], frames[index]->samplesPerPixel);
-				ss << (char)c.x << (char)c.y << (char)c.z;
-				auto idx = ((frames[index]->imageHeight -1 -j)*frames[index]->imageHeight + i) * 4;
-				data[idx] = (uint8_t)c.x;
-				data[idx+1] = (uint8_t)c.y;
-				data[idx+2] = (uint8_t)c.z;
-				data[idx+3] = (uint8_t)256;
-			}
+
+		//JPG ignores the alpha channel, so one RGBA buffer feeds both outputs
+		std::unique_ptr<uint8_t[]> data(new uint8_t[size_t(frame->imageWidth) * frame->imageHeight * 4]);
+		frame->framebuffer->Resolve(data.get(), 4);
+		WriteImage(frame, path / (name + "-Frame" + std::to_string(index) + ".jpg"), data.get());
+		GifWriteFrame(&writer, data.get(), frame->imageWidth, frame->imageHeight, gifRate, 8, true);
+
+		const std::pair<FramebufferAOV, const char*> aovNames[] = { { AOV_Albedo, "albedo" }, { AOV_Normal, "normal" } };
+		for (const auto& aov : aovNames) {
+			if (!frame->framebuffer->HasAOV(aov.first)) continue;
+			frame->framebuffer->ResolveAOV(aov.first, data.get(), 4);
+			WriteImage(frame, path / (name + "-Frame" + std::to_string(index) + "-" + aov.second + ".jpg"), data.get());
 		}
-		auto str = ss.str();
-		auto filePath = path / (name + "-Frame" + std::to_string(index) + ".jpg");
-		Image::Write2JPG(filePath.string().c_str(), str.c_str(), frames[index]->imageWidth, frames[index]->imageHeight, 100);
-		GifWriteFrame(&writer, data, frames[index]->imageWidth, frames[index]->imageHeight, gifRate, 8, true);
-		delete[] data;
-		auto time = (::GetTickCount() - start) / 1000.0f;
-		totalTime += time; consoleMutex.lock();
-		std::cerr << "The frame " << index + 1 << " rendering is complete.Total time: " << time << "s\n" << std::flush;
-		consoleMutex.unlock();
+		frame->framebuffer.reset();
+		reporter.Stop();
+		totalTime += std::chrono::duration<Float>(std::chrono::steady_clock::now() - start).count();
 	}
 
 	GifEnd(&writer);
-	std::stringstream timeStr;
-	int hours = std::floor(totalTime / 3600);
-	int minutes = std::floor(totalTime % 3600 / 60);
-	int seconds = std::floor(totalTime % 3600 % 60);
-	if (hours > 0) timeStr << std::to_string(hours) << "h";
-	if (hours > 0 || minutes > 0) timeStr << std::to_string(minutes) << "m";
-	timeStr << std::to_string(seconds) << "s";
-	consoleMutex.lock();
-	std::cerr << "\nAll rendering is completed, the total time is " << timeStr.str() << "\n" << std::flush;
-	consoleMutex.unlock();
-}
\ No newline at end of file
+	if (reporter.mode == ProgressMode::JsonLines)
+		std::cerr << "{\"event\":\"render_end\",\"elapsed_s\":" << totalTime << "}\n" << std::flush;
+	else
+		std::cerr << "\nAll rendering is completed, the total time is " << FormatDuration(totalTime) << "\n" << std::flush;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Core.hpp"
+#include <memory>
+
+enum FramebufferAOV : uint32_t {
+	AOV_None = 0,
+	AOV_Albedo = 1 << 0,
+	AOV_Normal = 1 << 1,
+	AOV_Variance = 1 << 2	//per-pixel luminance second moment, used by adaptive sampling
+};
+
+//16 bytes per pixel: radiance sum in float plus the number of samples taken,
+//so adaptive and progressive schedulers can average per pixel.
+struct alignas(16) FramePixel {
+	float r, g, b;
+	uint32_t samples;
+};
+
+struct FrameAOV {
+	float x, y, z;
+};
+
+//Pixel (0, 0) is the lower left corner, matching the v direction of Camera::GenerateRay.
+//Different threads may write different pixels concurrently; a single pixel must only
+//ever be written by one thread at a time.
+class Framebuffer {
+public:
+	Framebuffer(int width, int height, uint32_t aovs = AOV_None)
+		: width(width), height(height), aovs(aovs), pixels(new FramePixel[size_t(width) * height]) {
+		if (aovs & AOV_Albedo) albedo.reset(new FrameAOV[size_t(width) * height]);
+		if (aovs & AOV_Normal) normal.reset(new FrameAOV[size_t(width) * height]);
+		if (aovs & AOV_Variance) luminanceSquares.reset(new float[size_t(width) * height]);
+		Clear();
+	}
+
+	void Clear() {
+		size_t count = size_t(width) * height;
+		memset(pixels.get(), 0, count * sizeof(FramePixel));
+		if (albedo) memset(albedo.get(), 0, count * sizeof(FrameAOV));
+		if (normal) memset(normal.get(), 0, count * sizeof(FrameAOV));
+		if (luminanceSquares) memset(luminanceSquares.get(), 0, count * sizeof(float));
+	}
+
+	bool HasAOV(FramebufferAOV aov) const { return (aovs & aov) != 0; }
+
+	//c is the sum of n samples
+	inline void AddSamples(int x, int y, const Color& c, uint32_t n = 1) {
+		auto& p = pixels[Index(x, y)];
+		p.r += static_cast<float>(c.x);
+		p.g += static_cast<float>(c.y);
+		p.b += static_cast<float>(c.z);
+		p.samples += n;
+	}
+
+	//Single sample; also feeds the variance estimate when AOV_Variance is enabled.
+	inline void AddSample(int x, int y, const Color& c) {
+		AddSamples(x, y, c, 1);
+		if (luminanceSquares) {
+			auto l = static_cast<float>(Luminance(c));
+			luminanceSquares[Index(x, y)] += l * l;
+		}
+	}
+
+	//Standard error of the pixel mean relative to the mean luminance. Needs AOV_Variance
+	//and only counts samples added through AddSample.
+	Float RelativeError(int x, int y) const {
+		auto& p = pixels[Index(x, y)];
+		if (p.samples < 2) return Infinity;
+		Float n = p.samples;
+		Float mean = Luminance(Color(p.r, p.g, p.b)) / n;
+		Float variance = (luminanceSquares[Index(x, y)] / n - mean * mean) * n / (n - 1);
+		if (variance < 0) variance = 0;
+		return std::sqrt(variance / n) / (mean + 1e-3f);
+	}
+
+	inline void SetAlbedo(int x, int y, const Color& c) {
+		albedo[Index(x, y)] = { float(c.x), float(c.y), float(c.z) };
+	}
+
+	inline void SetNormal(int x, int y, const Vector3f& n) {
+		normal[Index(x, y)] = { float(n.x), float(n.y), float(n.z) };
+	}
+
+	inline const FramePixel& Pixel(int x, int y) const { return pixels[Index(x, y)]; }
+	inline uint32_t SampleCount(int x, int y) const { return pixels[Index(x, y)].samples; }
+	inline Color Sum(int x, int y) const {
+		auto& p = pixels[Index(x, y)];
+		return Color(p.r, p.g, p.b);
+	}
+	inline Color Average(int x, int y) const {
+		auto& p = pixels[Index(x, y)];
+		return p.samples > 0 ? Color(p.r, p.g, p.b) / p.samples : Color(0, 0, 0);
+	}
+
+	uint64_t TotalSamples() const {
+		uint64_t total = 0;
+		for (size_t i = 0, count = size_t(width) * height; i < count; ++i) total += pixels[i].samples;
+		return total;
+	}
+
+	//Tone maps into top-down 8-bit rows with the given channel count (3 = RGB, 4 = RGBA).
+	void Resolve(uint8_t* out, int channels) const;
+	//Same layout as Resolve; normals are remapped from [-1, 1] to [0, 1].
+	void ResolveAOV(FramebufferAOV aov, uint8_t* out, int channels) const;
+
+public:
+	const int width, height;
+
+private:
+	inline size_t Index(int x, int y) const { return size_t(y) * width + x; }
+
+	uint32_t aovs;
+	std::unique_ptr<FramePixel[]> pixels;
+	std::unique_ptr<FrameAOV[]> albedo;
+	std::unique_ptr<FrameAOV[]> normal;
+	std::unique_ptr<float[]> luminanceSquares;
+};
+
+void Framebuffer::Resolve(uint8_t* out, int channels) const {
+	for (int j = height - 1; j >= 0; --j) {
+		auto row = out + size_t(height - 1 - j) * width * channels;
+		for (int i = 0; i < width; ++i) {
+			auto& p = pixels[Index(i, j)];
+			auto c = ConvertColor(Color(p.r, p.g, p.b), p.samples > 0 ? p.samples : 1);
+			auto dst = row + i * channels;
+			dst[0] = (uint8_t)c.x;
+			dst[1] = (uint8_t)c.y;
+			dst[2] = (uint8_t)c.z;
+			if (channels == 4) dst[3] = 255;
+		}
+	}
+}
+
+void Framebuffer::ResolveAOV(FramebufferAOV aov, uint8_t* out, int channels) const {
+	const FrameAOV* source = aov == AOV_Albedo ? albedo.get() : normal.get();
+	if (!source) return;
+	for (int j = height - 1; j >= 0; --j) {
+		auto row = out + size_t(height - 1 - j) * width * channels;
+		for (int i = 0; i < width; ++i) {
+			auto v = source[Index(i, j)];
+			if (aov == AOV_Normal) v = { 0.5f * (v.x + 1), 0.5f * (v.y + 1), 0.5f * (v.z + 1) };
+			auto dst = row + i * channels;
+			dst[0] = (uint8_t)(255.999f * Clamp<float>(v.x, 0.0f, 1.0f));
+			dst[1] = (uint8_t)(255.999f * Clamp<float>(v.y, 0.0f, 1.0f));
+			dst[2] = (uint8_t)(255.999f * Clamp<float>(v.z, 0.0f, 1.0f));
+			if (channels == 4) dst[3] = 255;
+		}
+	}
+}
@@ -8,7 +8,7 @@
 
 class Image {
 public:
-	static void Write2JPG(const char* filePath, const char *data, int width, int height, int quality) {
-		stbi_write_jpg(filePath, width, height, 3, data, quality);
+	static void Write2JPG(const char* filePath, const char *data, int width, int height, int quality, int components = 3) {
+		stbi_write_jpg(filePath, width, height, components, data, quality);
 	}
 };
\ No newline at end of file
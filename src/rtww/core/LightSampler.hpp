@@ -0,0 +1,298 @@
+#pragma once
+
+#include "Core.hpp"
+#include "Shape.hpp"
+#include "World.hpp"
+#include "Material.hpp"
+
+enum class LightSelection {
+	Uniform,	//every light equally likely, like ShapesSet::ShapeRandom
+	Power,		//proportional to emitted power, alias table, O(1)
+	BVH			//estimated contribution at the shading point, light BVH, O(log n)
+};
+
+//Vose's alias method: O(n) construction, O(1) sampling from a discrete distribution.
+class AliasTable {
+public:
+	AliasTable() {}
+	AliasTable(const std::vector<Float>& weights);
+
+	bool Empty() const { return bins.empty(); }
+	Float PMF(int index) const { return bins[index].pmf; }
+	int Sample(Float u) const {
+		int n = static_cast<int>(bins.size());
+		int index = std::min(static_cast<int>(u * n), n - 1);
+		Float up = u * n - index;
+		return up < bins[index].q ? index : bins[index].alias;
+	}
+
+private:
+	struct Bin {
+		Float q, pmf;
+		int alias;
+	};
+	std::vector<Bin> bins;
+};
+
+AliasTable::AliasTable(const std::vector<Float>& weights) {
+	int n = static_cast<int>(weights.size());
+	bins.resize(n);
+	double sum = 0;
+	for (auto w : weights) sum += w;
+	for (int i = 0; i < n; ++i)
+		bins[i].pmf = sum > 0 ? Float(weights[i] / sum) : Float(1) / n;
+
+	std::vector<int> small, large;
+	std::vector<double> scaled(n);
+	for (int i = 0; i < n; ++i) {
+		scaled[i] = double(bins[i].pmf) * n;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(); small.pop_back();
+		int l = large.back(); large.pop_back();
+		bins[s].q = Float(scaled[s]);
+		bins[s].alias = l;
+		scaled[l] = scaled[l] + scaled[s] - 1;
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+	//whatever is left is 1 up to rounding
+	for (int i : small) { bins[i].q = 1; bins[i].alias = i; }
+	for (int i : large) { bins[i].q = 1; bins[i].alias = i; }
+}
+
+//Picks one light for next-event estimation and evaluates the matching solid angle
+//pdf. PDFValue is the density of the whole mixture, summed over the lights a direction
+//crosses, which the light BVH finds without a loop over every light.
+class LightSampler {
+public:
+	LightSampler() {}
+	LightSampler(const ShapesSet& lightSet, LightSelection mode = LightSelection::BVH);
+
+	//power <= 0 falls back to the light's area
+	void Add(std::shared_ptr<Shape> light, Float power = 0);
+	//Adds every shape under scene whose material is a DiffuseLight, with its emitted power.
+	void AddSceneLights(std::shared_ptr<Shape> scene);
+	void Build(LightSelection mode);
+
+	bool Empty() const { return lights.empty(); }
+	size_t Size() const { return lights.size(); }
+
+	//Direction from o towards a point on a chosen light; uLight picks the light, u the point.
+	Vector3f Generate(const Point3f& o, Float uLight, const Point2f& u) const;
+	Float PDFValue(const Point3f& o, const Vector3f& v) const;
+
+	Float SelectionPMF(const Point3f& o, int light) const;
+
+private:
+	struct Node {
+		AABB bounds;
+		Float power;
+		int secondChild;	//index of the right child, the left one directly follows
+		int light;			//leaf only, -1 for interior nodes
+	};
+
+	//median splits keep the depth near log2(n), far below the 64 bits of a trail
+	int BuildNode(std::vector<int>& indices, int start, int end, uint32_t depth, uint64_t trail);
+	Float Importance(const Node& node, const Point3f& o) const;
+	int SelectLight(const Point3f& o, Float u) const;
+	template <typename Visit>
+	void ForEachCrossedLight(const Ray& r, Visit visit) const;
+
+public:
+	LightSelection mode = LightSelection::BVH;
+	std::vector<std::shared_ptr<Shape>> lights;
+	std::vector<Float> powers;
+
+private:
+	AliasTable powerTable;
+	std::vector<Node> nodes;
+	std::vector<uint64_t> trails;	//bit d set: the path from the root takes the right child at depth d
+	std::vector<AABB> lightBounds;
+};
+
+LightSampler::LightSampler(const ShapesSet& lightSet, LightSelection mode) {
+	for (const auto& light : lightSet.objects) Add(light);
+	Build(mode);
+}
+
+void LightSampler::Add(std::shared_ptr<Shape> light, Float power) {
+	if (power <= 0) power = light->Area();
+	lights.push_back(light);
+	powers.push_back(power);
+}
+
+void LightSampler::AddSceneLights(std::shared_ptr<Shape> scene) {
+	std::vector<std::shared_ptr<Shape>> pending{ scene };
+	std::vector<std::shared_ptr<Shape>> children;
+	size_t unsampled = 0;
+	while (!pending.empty()) {
+		auto shape = pending.back();
+		pending.pop_back();
+		children.clear();
+		shape->GetChildren(children);
+		if (!children.empty()) {
+			pending.insert(pending.end(), children.begin(), children.end());
+			continue;
+		}
+
+		auto emitter = std::dynamic_pointer_cast<DiffuseLight>(shape->GetMaterial());
+		if (!emitter) continue;
+		if (!shape->IsSamplable()) {
+			++unsampled;
+			continue;
+		}
+		AABB bounds;
+		shape->BoundingBox(0, 0, bounds);
+		auto center = bounds.Min() + 0.5f * (bounds.Max() - bounds.Min());
+		//diffuse emitter: radiance times area times pi, radiance taken at the texture center
+		auto power = Luminance(emitter->emit->Value(0.5f, 0.5f, center)) * shape->Area() * Pi;
+		if (power > 0) Add(shape, power);
+	}
+	//one line for the scene, an emissive mesh would otherwise report every triangle
+	if (unsampled > 0)
+		std::cerr << unsampled << " emissive shapes without PDFValue/ShapeRandom support are not sampled as lights.\n";
+}
+
+void LightSampler::Build(LightSelection selection) {
+	mode = selection;
+	nodes.clear();
+
+	//a light without bounds could still be selected but PDFValue would never find it in
+	//the light BVH, so it is dropped before the power table is built
+	lightBounds.clear();
+	size_t kept = 0;
+	for (size_t i = 0; i < lights.size(); ++i) {
+		AABB bounds;
+		if (!lights[i]->BoundingBox(0, 0, bounds)) {
+			std::cerr << "No bounding box for light " << i << ", it is not sampled as a light.\n";
+			continue;
+		}
+		lights[kept] = lights[i];
+		powers[kept] = powers[i];
+		lightBounds.push_back(bounds);
+		++kept;
+	}
+	lights.resize(kept);
+	powers.resize(kept);
+	if (lights.empty()) return;
+
+	powerTable = AliasTable(powers);
+	trails.assign(lights.size(), 0);
+	std::vector<int> indices(lights.size());
+	for (size_t i = 0; i < indices.size(); ++i) indices[i] = static_cast<int>(i);
+	nodes.reserve(2 * lights.size());
+	BuildNode(indices, 0, static_cast<int>(indices.size()), 0, 0);
+}
+
+int LightSampler::BuildNode(std::vector<int>& indices, int start, int end, uint32_t depth, uint64_t trail) {
+	int nodeIndex = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+	if (end - start == 1) {
+		int light = indices[start];
+		nodes[nodeIndex] = { lightBounds[light], powers[light], -1, light };
+		trails[light] = trail;
+		return nodeIndex;
+	}
+
+	AABB bounds = lightBounds[indices[start]];
+	for (int i = start + 1; i < end; ++i) bounds = SurroundingBox(bounds, lightBounds[indices[i]]);
+	auto extent = bounds.Max() - bounds.Min();
+	int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+	int mid = (start + end) / 2;
+	std::nth_element(indices.begin() + start, indices.begin() + mid, indices.begin() + end, [&](int a, int b) {
+		return lightBounds[a].Min()[axis] + lightBounds[a].Max()[axis] < lightBounds[b].Min()[axis] + lightBounds[b].Max()[axis];
+	});
+
+	BuildNode(indices, start, mid, depth + 1, trail);
+	int second = BuildNode(indices, mid, end, depth + 1, trail | (uint64_t(1) << depth));
+	nodes[nodeIndex] = { bounds, nodes[nodeIndex + 1].power + nodes[second].power, second, -1 };
+	return nodeIndex;
+}
+
+//Power over squared distance to the node, the distance clamped to half the node
+//diagonal so points inside a cluster do not blow up.
+Float LightSampler::Importance(const Node& node, const Point3f& o) const {
+	auto center = node.bounds.Min() + 0.5f * (node.bounds.Max() - node.bounds.Min());
+	auto distanceSquared = (center - o).LengthSquared();
+	auto halfDiagonalSquared = 0.25f * (node.bounds.Max() - node.bounds.Min()).LengthSquared();
+	return node.power / std::max<Float>(distanceSquared, halfDiagonalSquared);
+}
+
+int LightSampler::SelectLight(const Point3f& o, Float u) const {
+	if (mode == LightSelection::Uniform)
+		return std::min(static_cast<int>(u * lights.size()), static_cast<int>(lights.size()) - 1);
+	if (mode == LightSelection::Power)
+		return powerTable.Sample(u);
+
+	int index = 0;
+	while (nodes[index].light < 0) {
+		auto left = Importance(nodes[index + 1], o);
+		auto right = Importance(nodes[nodes[index].secondChild], o);
+		Float pLeft = left + right > 0 ? left / (left + right) : 0.5f;
+		if (u < pLeft) {
+			u = std::min<Float>(u / pLeft, 1 - std::numeric_limits<Float>::epsilon());
+			index = index + 1;
+		}
+		else {
+			u = std::min<Float>((u - pLeft) / (1 - pLeft), 1 - std::numeric_limits<Float>::epsilon());
+			index = nodes[index].secondChild;
+		}
+	}
+	return nodes[index].light;
+}
+
+Float LightSampler::SelectionPMF(const Point3f& o, int light) const {
+	if (mode == LightSelection::Uniform) return Float(1) / lights.size();
+	if (mode == LightSelection::Power) return powerTable.PMF(light);
+
+	Float pmf = 1;
+	int index = 0;
+	for (uint32_t depth = 0; nodes[index].light < 0; ++depth) {
+		auto left = Importance(nodes[index + 1], o);
+		auto right = Importance(nodes[nodes[index].secondChild], o);
+		Float pLeft = left + right > 0 ? left / (left + right) : 0.5f;
+		if ((trails[light] >> depth) & 1) {
+			pmf *= 1 - pLeft;
+			index = nodes[index].secondChild;
+		}
+		else {
+			pmf *= pLeft;
+			index = index + 1;
+		}
+	}
+	return nodes[index].light == light ? pmf : 0;
+}
+
+//Calls visit(light) for every light whose bounds r crosses, not only the nearest one:
+//lights overlapping in solid angle all contribute to the density of the direction.
+template <typename Visit>
+void LightSampler::ForEachCrossedLight(const Ray& r, Visit visit) const {
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (!node.bounds.Intersection(r, 0.001f, Infinity)) continue;
+		if (node.light >= 0) visit(node.light);
+		else {
+			stack[top++] = node.secondChild;
+			stack[top++] = static_cast<int>(&node - &nodes[0]) + 1;
+		}
+	}
+}
+
+Vector3f LightSampler::Generate(const Point3f& o, Float uLight, const Point2f& u) const {
+	return lights[SelectLight(o, uLight)]->ShapeRandom(o, u);
+}
+
+Float LightSampler::PDFValue(const Point3f& o, const Vector3f& v) const {
+	if (lights.empty()) return 0;
+	Float pdf = 0;
+	ForEachCrossedLight(Ray(o, v), [&](int light) {
+		//each light's PDFValue is 0 when v misses it
+		auto lightPdf = lights[light]->PDFValue(o, v);
+		if (lightPdf > 0) pdf += SelectionPMF(o, light) * lightPdf;
+	});
+	return pdf;
+}
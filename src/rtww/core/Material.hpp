@@ -1,4 +1,4 @@
-#pragma
+#pragma once
 #include "Core.hpp"
 #include "Texture.hpp"
 #include "PDF.hpp"
@@ -12,21 +12,37 @@ struct ScatterRecord {
 	std::shared_ptr<PDF> pdfPtr;
 };
 
+//Concrete type of a material, so batched shading can group hits and call the
+//known implementation directly instead of going through the vtable.
+enum class MaterialType : uint8_t {
+	Lambertian,
+	Metal,
+	Dielectric,
+	DiffuseLight,
+	Other,
+	Count
+};
+
 class Material {
 public:
+	Material(MaterialType type = MaterialType::Other) : type(type) {}
+
 	virtual bool Scatter(const Ray& r, const IntersectionRecord& rec, ScatterRecord& srec) const { return false; };
 	virtual Float ScatteringPDF(const Ray& r, const IntersectionRecord& rec, const Ray& scattered) const { return 0; }
 	virtual Color Emitted(const Ray& r, const IntersectionRecord& rec, Float u, Float v, const Point3f& p) const { return Color(0, 0, 0); }
+
+public:
+	const MaterialType type;
 };
 
 class Lambertian :public Material {
 public:
-	Lambertian(const Color& c) :albedo(std::make_shared<SolidColorTexture>(c)) {}
-	Lambertian(std::shared_ptr<Texture> a) :albedo(a) {}
+	Lambertian(const Color& c) :Material(MaterialType::Lambertian), albedo(std::make_shared<SolidColorTexture>(c)) {}
+	Lambertian(std::shared_ptr<Texture> a) :Material(MaterialType::Lambertian), albedo(a) {}
 
 	virtual bool Scatter(const Ray& r, const IntersectionRecord& rec, ScatterRecord& srec) const override {
 		srec.isSpecular = false;
-		srec.attenuation = albedo->Value(rec.u, rec.v, rec.hitPoint);
+		srec.attenuation = albedo->FilteredValue(rec);
 		srec.pdfPtr = std::make_shared<CosinePDF>(rec.normal);
 		return true;
 	}
@@ -42,11 +58,11 @@ public:
 
 class Metal : public Material {
 public:
-	Metal(const Color& c, Float f) :albedo(c), fuzz(f < 1.0f ? f : 1.0f) {}
+	Metal(const Color& c, Float f) :Material(MaterialType::Metal), albedo(c), fuzz(f < 1.0f ? f : 1.0f) {}
 
 	virtual bool Scatter(const Ray& r, const IntersectionRecord& rec, ScatterRecord& srec) const override {
 		Vector3f reflected = r.direction.Normalize().Reflect(rec.normal);
-		srec.specularRay = Ray(rec.hitPoint, reflected + fuzz * RandomInUnitSphere());
+		srec.specularRay = rec.SpawnRay(reflected + fuzz * RandomInUnitSphere(), r.time);
 		srec.attenuation = albedo;
 		srec.isSpecular = true;
 		srec.pdfPtr = 0;
@@ -60,7 +76,7 @@ public:
 
 class Dielectric : public Material {
 public:
-	Dielectric(/*const Color& c, */Float ir) :/*albedo(c), */indexOfRefraction(ir) {}
+	Dielectric(/*const Color& c, */Float ir) :Material(MaterialType::Dielectric), /*albedo(c), */indexOfRefraction(ir) {}
 
 	virtual bool Scatter(const Ray& r, const IntersectionRecord& rec, ScatterRecord& srec) const override {
 		srec.isSpecular = true;
@@ -78,12 +94,12 @@ public:
 		else
 			dir = unitDir.Refract(rec.normal, refractionRatio);
 
-		srec.specularRay = Ray(rec.hitPoint, dir, r.time);
+		srec.specularRay = rec.SpawnRay(dir, r.time);
 		return true;
 	}
 
 private:
-	static double Reflectance(double cosine, double refractionRatio) {
+	static Float Reflectance(Float cosine, Float refractionRatio) {
 		//Schlick's approximation
 		auto r0 = (1 - refractionRatio) / (1 + refractionRatio);
 		r0 = r0 * r0;
@@ -97,8 +113,8 @@ public:
 
 class DiffuseLight : public Material {
 public:
-	DiffuseLight(std::shared_ptr<Texture> a) : emit(a) {}
-	DiffuseLight(Color c) : emit(std::make_shared<SolidColorTexture>(c)) {}
+	DiffuseLight(std::shared_ptr<Texture> a) : Material(MaterialType::DiffuseLight), emit(a) {}
+	DiffuseLight(Color c) : Material(MaterialType::DiffuseLight), emit(std::make_shared<SolidColorTexture>(c)) {}
 
 	virtual bool Scatter(const Ray& r, const IntersectionRecord& rec, ScatterRecord& srec) const override {
 		return false;
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Core.hpp"
+#include "Material.hpp"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+//Materials and image textures shared by every model loaded through the same cache. MTL
+//materials that map to the same Material parameters get one object, and every image
+//file is loaded once however many materials use it.
+class MaterialCache {
+public:
+	//The cache models use when none is given.
+	static std::shared_ptr<MaterialCache> Shared() {
+		static auto shared = std::make_shared<MaterialCache>();
+		return shared;
+	}
+
+	//Reads an MTL file, baseDirectory resolves the texture paths in it. Maps every material
+	//name of the file to its shared Material.
+	bool LoadLibrary(const std::string& filePath, const std::string& baseDirectory,
+		std::unordered_map<std::string, std::shared_ptr<Material>>& named);
+
+	//Kd (or map_Kd) Lambertian, Ke DiffuseLight, transparent or illum 4/6/7/9 Dielectric
+	//with Ni, illum 3 Metal with Ks and a fuzz from Ns.
+	std::shared_ptr<Material> Get(const tinyobj::material_t& mtl, const std::string& baseDirectory);
+	std::shared_ptr<Texture> GetImageTexture(const std::string& filePath);
+	std::shared_ptr<Material> GetDefault();
+
+	//Image textures created from now on read their images page by page instead of whole,
+	//for scenes with more texture data than memory. nullptr loads them whole again.
+	void SetTexturePaging(std::shared_ptr<TexturePageCache> cache) { pageCache = cache; }
+
+	size_t MaterialCount() const { return materials.size(); }
+	size_t TextureCount() const { return textures.size(); }
+
+private:
+	template <typename Create>
+	std::shared_ptr<Material> Find(const std::string& key, Create create) {
+		auto& material = materials[key];
+		if (!material) material = create();
+		return material;
+	}
+
+	std::unordered_map<std::string, std::shared_ptr<Material>> materials;
+	std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+	std::shared_ptr<TexturePageCache> pageCache;
+};
+
+bool MaterialCache::LoadLibrary(const std::string& filePath, const std::string& baseDirectory,
+	std::unordered_map<std::string, std::shared_ptr<Material>>& named) {
+	std::ifstream in(filePath);
+	if (!in) {
+		std::cerr << "Load Material Error: Fail to open " << filePath << '\n';
+		return false;
+	}
+	std::map<std::string, int> indices;
+	std::vector<tinyobj::material_t> mtls;
+	std::string warning, error;
+	tinyobj::LoadMtl(&indices, &mtls, &in, &warning, &error);
+	if (!warning.empty()) std::cout << "Load Material Warning: " << warning;
+	if (!error.empty()) std::cerr << "Load Material Error: " << error;
+	for (const auto& mtl : mtls) named[mtl.name] = Get(mtl, baseDirectory);
+	return true;
+}
+
+std::shared_ptr<Material> MaterialCache::Get(const tinyobj::material_t& mtl, const std::string& baseDirectory) {
+	auto color = [](const tinyobj::real_t c[3]) { return Color(c[0], c[1], c[2]); };
+	//hexfloat keys only match bit identical parameters
+	std::stringstream key;
+	key << std::hexfloat;
+
+	auto emission = color(mtl.emission);
+	if (!IsBlack(emission)) {
+		key << "light " << emission;
+		return Find(key.str(), [&] { return std::make_shared<DiffuseLight>(emission); });
+	}
+
+	bool transparent = mtl.dissolve < 1 || mtl.illum == 4 || mtl.illum == 6 || mtl.illum == 7 || mtl.illum == 9;
+	if (transparent && mtl.ior > 1) {
+		key << "dielectric " << mtl.ior;
+		return Find(key.str(), [&] { return std::make_shared<Dielectric>(mtl.ior); });
+	}
+
+	if (mtl.illum == 3) {
+		auto albedo = color(mtl.specular);
+		if (IsBlack(albedo)) albedo = color(mtl.diffuse);
+		//Phong exponent to a roughness like fuzz: sharp for Ns near 1000, rough near 0
+		Float fuzz = Clamp<Float>(std::sqrt(Float(2) / (std::max<Float>(mtl.shininess, 0) + 2)), 0, 1);
+		key << "metal " << albedo << ' ' << fuzz;
+		return Find(key.str(), [&] { return std::make_shared<Metal>(albedo, fuzz); });
+	}
+
+	if (!mtl.diffuse_texname.empty()) {
+		auto path = baseDirectory + mtl.diffuse_texname;
+		key << "texture " << path;
+		return Find(key.str(), [&] { return std::make_shared<Lambertian>(GetImageTexture(path)); });
+	}
+	auto albedo = color(mtl.diffuse);
+	key << "lambertian " << albedo;
+	return Find(key.str(), [&] { return std::make_shared<Lambertian>(albedo); });
+}
+
+std::shared_ptr<Texture> MaterialCache::GetImageTexture(const std::string& filePath) {
+	auto& texture = textures[filePath];
+	if (texture) return texture;
+	if (pageCache) texture = std::make_shared<PagedImageTexture>(filePath.c_str(), pageCache);
+	else texture = std::make_shared<ImageTexture>(filePath.c_str());
+	return texture;
+}
+
+std::shared_ptr<Material> MaterialCache::GetDefault() {
+	return Find("default", [] { return std::make_shared<Lambertian>(Color(0.89, 0.89, 0.89)); });
+}
@@ -1,32 +1,47 @@
 #pragma once
 #include "Transform.hpp"
 
+//Object space triangle data of one mesh as the loader builds it, Mesh takes the buffers over.
+struct MeshData {
+	std::vector<int> indices;
+	std::vector<Point3f> vertices;
+	std::vector<Vector3f> normals;	//empty when the source has none
+	std::vector<Point2f> uvs;		//empty when the source has none
+	std::string material;			//usemtl name, empty for none
+};
+
 class Mesh {
 public:
 	Mesh(std::shared_ptr<Transform> transform, int tNum, const int* vIndices,
 		int vNum, const Point3f* v, const Vector3f* n, const Point2f* uv, std::shared_ptr<Material> material)
-		: material(material), trianglesNum(tNum), verticesNum(vNum), vertexIndices(vIndices, vIndices + 3 * tNum) {
+		: trianglesNum(tNum), verticesNum(vNum), vertexIndices(vIndices, vIndices + 3 * tNum), material(material) {
 
-		vertices.reset(new Point3f[vNum]);
-		auto o2w = transform->GetObject2WorldMatrix();
-		for (int i = 0; i < vNum; ++i) vertices[i] = o2w(v[i]);
+		vertices.resize(vNum);
+		for (int i = 0; i < vNum; ++i) vertices[i] = transform->ToWorld(v[i]);
 
-		if (uv) {
-			uvs.reset(new Point2f[vNum]);
-			memcpy(uvs.get(), uv, vNum * sizeof(Float));
-		}
+		if (uv) uvs.assign(uv, uv + vNum);
 
 		if (n) {
-			normals.reset(new Vector3f[vNum]);
-			for (int i = 0; i < vNum; ++i) normals[i] = o2w(n[i]);
+			normals.resize(vNum);
+			for (int i = 0; i < vNum; ++i) normals[i] = transform->NormalToWorld(n[i]).Normalize();
 		}
 	}
 
+	//Moves the buffers of data in and transforms them in place, nothing is copied.
+	Mesh(std::shared_ptr<Transform> transform, MeshData&& data, std::shared_ptr<Material> material)
+		: trianglesNum(static_cast<int>(data.indices.size() / 3)), verticesNum(static_cast<int>(data.vertices.size())),
+		vertices(std::move(data.vertices)), uvs(std::move(data.uvs)), normals(std::move(data.normals)), vertexIndices(std::move(data.indices)),
+		material(material) {
+
+		for (auto& v : vertices) v = transform->ToWorld(v);
+		for (auto& n : normals) n = transform->NormalToWorld(n).Normalize();
+	}
+
 public:
 	const int trianglesNum, verticesNum;
-	std::unique_ptr<Point3f[]> vertices;
-	std::unique_ptr<Point2f[]> uvs;
-	std::unique_ptr<Vector3f[]> normals;
+	std::vector<Point3f> vertices;
+	std::vector<Point2f> uvs;		//empty when the mesh has none
+	std::vector<Vector3f> normals;	//empty when the mesh has none
 	std::vector<int> vertexIndices;
 	std::shared_ptr<Material> material;
 };
\ No newline at end of file
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "Core.hpp"
+#include "Mesh.hpp"
+#include "core/File.hpp"
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+//Pointers to the arrays of one mesh, either into a MeshData or into a mapped cache file.
+struct MeshView {
+	MeshView() {}
+	MeshView(const MeshData& data)
+		: trianglesNum(static_cast<int>(data.indices.size() / 3)), verticesNum(static_cast<int>(data.vertices.size())),
+		indices(data.indices.data()), vertices(data.vertices.data()),
+		normals(data.normals.empty() ? nullptr : data.normals.data()), uvs(data.uvs.empty() ? nullptr : data.uvs.data()),
+		material(data.material) {}
+
+	int trianglesNum = 0, verticesNum = 0;
+	const int* indices = nullptr;
+	const Point3f* vertices = nullptr;
+	const Vector3f* normals = nullptr;
+	const Point2f* uvs = nullptr;
+	std::string material;
+};
+
+//Binary mesh cache written next to an OBJ on first load and memory mapped afterwards.
+//Layout: header, one entry per mesh, then the index, position, normal and uv arrays of
+//every mesh, each 16 byte aligned, then the material names and the mtllib list. The arrays are stored exactly as Point3f/Vector3f/
+//Point2f are laid out in memory, so the meshes read them in place. A cache is only used
+//when its source size and content hash match the OBJ and it was written with the same
+//Float type.
+class MeshCache {
+public:
+	static constexpr uint32_t Version = 3;
+
+	//64 bit FNV-1a over 8 byte words, the tail byte by byte.
+	static uint64_t Hash(const uint8_t* bytes, size_t size);
+
+	bool Open(const char* filePath, uint64_t sourceSize, uint64_t sourceHash);
+	const std::vector<MeshView>& Meshes() const { return views; }
+	const std::vector<std::string>& MaterialLibraries() const { return libraries; }
+
+	static bool Write(const char* filePath, uint64_t sourceSize, uint64_t sourceHash, const std::vector<MeshView>& meshes,
+		const std::vector<std::string>& materialLibraries);
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t floatSize;
+		uint64_t sourceSize;
+		uint64_t sourceHash;
+		uint32_t meshCount;
+		uint32_t reserved;
+		uint64_t librariesOffset, librariesLength;	//file names separated by '\n'
+	};
+
+	struct Entry {
+		int32_t trianglesNum, verticesNum;
+		uint32_t hasNormals, hasUVs;
+		uint64_t indicesOffset, verticesOffset, normalsOffset, uvsOffset;
+		uint64_t materialOffset, materialLength;
+	};
+
+	static constexpr char Magic[8] = { 'R', 'T', 'W', 'W', 'M', 'S', 'H', '\0' };
+	static constexpr uint64_t Alignment = 16;
+	static uint64_t Align(uint64_t offset) { return (offset + Alignment - 1) & ~(Alignment - 1); }
+
+	bool Contains(uint64_t offset, uint64_t bytes) const {
+		return offset % Alignment == 0 && offset <= file.Size() && bytes <= file.Size() - offset;
+	}
+
+	MappedFile file;
+	std::vector<MeshView> views;
+	std::vector<std::string> libraries;
+};
+
+static_assert(sizeof(Point3f) == 3 * sizeof(Float) && sizeof(Vector3f) == 3 * sizeof(Float) && sizeof(Point2f) == 2 * sizeof(Float),
+	"The mesh cache stores vectors as packed Float arrays.");
+
+constexpr char MeshCache::Magic[8];
+
+uint64_t MeshCache::Hash(const uint8_t* bytes, size_t size) {
+	const uint64_t prime = 0x100000001b3ull;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < size; ++i) hash = (hash ^ bytes[i]) * prime;
+	return hash;
+}
+
+bool MeshCache::Open(const char* filePath, uint64_t sourceSize, uint64_t sourceHash) {
+	views.clear();
+	libraries.clear();
+	if (!file.Open(filePath)) return false;
+
+	Header header;
+	if (file.Size() < sizeof(Header)) return false;
+	memcpy(&header, file.Data(), sizeof(Header));
+	if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || header.floatSize != sizeof(Float)
+		|| header.sourceSize != sourceSize || header.sourceHash != sourceHash)
+		return false;
+	if (!Contains(Align(sizeof(Header)), uint64_t(header.meshCount) * sizeof(Entry)) || !Contains(header.librariesOffset, header.librariesLength))
+		return false;
+
+	auto entries = reinterpret_cast<const Entry*>(file.Data() + Align(sizeof(Header)));
+	for (uint32_t i = 0; i < header.meshCount; ++i) {
+		const auto& entry = entries[i];
+		if (entry.trianglesNum < 0 || entry.verticesNum < 0) return false;
+		uint64_t indexCount = 3 * uint64_t(entry.trianglesNum), vertexCount = uint64_t(entry.verticesNum);
+		if (!Contains(entry.indicesOffset, indexCount * sizeof(int)) || !Contains(entry.verticesOffset, vertexCount * sizeof(Point3f))
+			|| (entry.hasNormals && !Contains(entry.normalsOffset, vertexCount * sizeof(Vector3f)))
+			|| (entry.hasUVs && !Contains(entry.uvsOffset, vertexCount * sizeof(Point2f)))
+			|| !Contains(entry.materialOffset, entry.materialLength))
+			return false;
+
+		MeshView view;
+		view.trianglesNum = entry.trianglesNum;
+		view.verticesNum = entry.verticesNum;
+		view.indices = reinterpret_cast<const int*>(file.Data() + entry.indicesOffset);
+		view.vertices = reinterpret_cast<const Point3f*>(file.Data() + entry.verticesOffset);
+		if (entry.hasNormals) view.normals = reinterpret_cast<const Vector3f*>(file.Data() + entry.normalsOffset);
+		if (entry.hasUVs) view.uvs = reinterpret_cast<const Point2f*>(file.Data() + entry.uvsOffset);
+		view.material.assign(reinterpret_cast<const char*>(file.Data() + entry.materialOffset), entry.materialLength);
+		views.push_back(view);
+	}
+
+	auto names = reinterpret_cast<const char*>(file.Data() + header.librariesOffset);
+	for (uint64_t start = 0, end; start < header.librariesLength; start = end + 1) {
+		for (end = start; end < header.librariesLength && names[end] != '\n'; ++end) {}
+		libraries.emplace_back(names + start, names + end);
+	}
+	return true;
+}
+
+bool MeshCache::Write(const char* filePath, uint64_t sourceSize, uint64_t sourceHash, const std::vector<MeshView>& meshes,
+	const std::vector<std::string>& materialLibraries) {
+	Header header = {};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.floatSize = sizeof(Float);
+	header.sourceSize = sourceSize;
+	header.sourceHash = sourceHash;
+	header.meshCount = static_cast<uint32_t>(meshes.size());
+
+	std::vector<Entry> entries(meshes.size());
+	uint64_t offset = Align(sizeof(Header)) + Align(meshes.size() * sizeof(Entry));
+	auto reserve = [&offset](uint64_t bytes) {
+		auto start = offset;
+		offset = Align(offset + bytes);
+		return start;
+	};
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		const auto& mesh = meshes[i];
+		auto& entry = entries[i];
+		entry = {};
+		entry.trianglesNum = mesh.trianglesNum;
+		entry.verticesNum = mesh.verticesNum;
+		entry.hasNormals = mesh.normals != nullptr;
+		entry.hasUVs = mesh.uvs != nullptr;
+		entry.indicesOffset = reserve(3 * uint64_t(mesh.trianglesNum) * sizeof(int));
+		entry.verticesOffset = reserve(uint64_t(mesh.verticesNum) * sizeof(Point3f));
+		if (mesh.normals) entry.normalsOffset = reserve(uint64_t(mesh.verticesNum) * sizeof(Vector3f));
+		if (mesh.uvs) entry.uvsOffset = reserve(uint64_t(mesh.verticesNum) * sizeof(Point2f));
+		entry.materialLength = mesh.material.size();
+		entry.materialOffset = reserve(entry.materialLength);
+	}
+	std::string libraryNames;
+	for (const auto& library : materialLibraries) libraryNames += (libraryNames.empty() ? "" : "\n") + library;
+	header.librariesLength = libraryNames.size();
+	header.librariesOffset = reserve(header.librariesLength);
+
+	//written under a temporary name and renamed, so an interrupted run never leaves a
+	//truncated cache behind
+	std::string tempPath = std::string(filePath) + ".tmp";
+	std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cerr << "Fail to open " << tempPath << '\n' << std::flush;
+		return false;
+	}
+	uint64_t written = 0;
+	auto put = [&](uint64_t at, const void* bytes, uint64_t size) {
+		static const char zeros[Alignment] = {};
+		while (written < at) {
+			auto pad = std::min<uint64_t>(at - written, Alignment);
+			out.write(zeros, pad);
+			written += pad;
+		}
+		out.write(static_cast<const char*>(bytes), size);
+		written += size;
+	};
+	put(0, &header, sizeof(Header));
+	put(Align(sizeof(Header)), entries.data(), entries.size() * sizeof(Entry));
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		const auto& mesh = meshes[i];
+		const auto& entry = entries[i];
+		put(entry.indicesOffset, mesh.indices, 3 * uint64_t(mesh.trianglesNum) * sizeof(int));
+		put(entry.verticesOffset, mesh.vertices, uint64_t(mesh.verticesNum) * sizeof(Point3f));
+		if (mesh.normals) put(entry.normalsOffset, mesh.normals, uint64_t(mesh.verticesNum) * sizeof(Vector3f));
+		if (mesh.uvs) put(entry.uvsOffset, mesh.uvs, uint64_t(mesh.verticesNum) * sizeof(Point2f));
+		put(entry.materialOffset, mesh.material.data(), entry.materialLength);
+	}
+	put(header.librariesOffset, libraryNames.data(), header.librariesLength);
+	out.close();
+	if (!out) {
+		std::cerr << "Fail to write the mesh cache " << tempPath << '\n' << std::flush;
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	std::remove(filePath);
+	if (std::rename(tempPath.c_str(), filePath) != 0) {
+		std::cerr << "Fail to rename " << tempPath << " to " << filePath << '\n' << std::flush;
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -1,57 +1,92 @@
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
+#pragma once
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "ObjParser.hpp"
+#include "MaterialCache.hpp"
 
 class Model {
 public:
-	Model(const char* filename, std::shared_ptr<Transform> t) : transform(t){
+	//useCache: read the binary cache next to the OBJ when it matches, write it otherwise.
+	//parseThreads: threads parsing the OBJ, 0 for one per hardware thread.
+	//materials: shares materials and textures with other models, MaterialCache::Shared() if null.
+	Model(const char* filename, std::shared_ptr<Transform> t, bool useCache = true, uint32_t parseThreads = 0,
+		std::shared_ptr<MaterialCache> materials = nullptr)
+		: transform(t), useCache(useCache), parseThreads(parseThreads), materials(materials ? materials : MaterialCache::Shared()) {
 		Load(filename);
 	}
 
 	bool Load(const char* filename) {
-		tinyobj::ObjReader reader;
-
-		if (!reader.ParseFromFile(filename)) {
-			if (!reader.Error().empty())
-				std::cerr << "Load Model Error: " << reader.Error();
+		MappedFile source;
+		if (!source.Open(filename)) {
+			std::cerr << "Load Model Error: Fail to open " << filename << '\n';
 			return false;
 		}
+		auto sourceSize = source.Size();
+		auto sourceHash = MeshCache::Hash(source.Data(), sourceSize);
+		auto cachePath = std::string(filename) + ".rtwwmesh";
 
-		if (!reader.Warning().empty())
-			std::cout << "Load Model Warning: " << reader.Warning();
-
-		auto& attrib = reader.GetAttrib();
-		auto& shapes = reader.GetShapes();
-		auto& materials = reader.GetMaterials();
-
-		for (const auto& shape : shapes) {
-			int verticesNum = static_cast<int>(shape.mesh.indices.size());
-			int trianglesNum = verticesNum / 3;
-			Point3f* vertices = (Point3f*)malloc(sizeof(Point3f) * verticesNum);
-			Point2f* uvs = (Point2f*)malloc(sizeof(Point2f) * verticesNum);
-			Vector3f* normals = (Vector3f*)malloc(sizeof(Vector3f) * verticesNum);
-			int* vertexIndices = (int*)malloc(sizeof(int) * verticesNum);
-			int offset = 0;
-
-			for (const auto& index : shape.mesh.indices) {
-				vertices[offset] = Point3f(attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]);
-				uvs[offset] = Point2f(attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]);
-				normals[offset] = Vector3f(attrib.normals[3 * index.normal_index + 0],
-					attrib.normals[3 * index.normal_index + 1],
-					attrib.normals[3 * index.normal_index + 2]);
-				vertexIndices[offset] = offset;
-				++offset;
+		if (useCache) {
+			MeshCache cache;
+			if (cache.Open(cachePath.c_str(), sourceSize, sourceHash)) {
+				LoadMaterials(filename, cache.MaterialLibraries());
+				for (const auto& view : cache.Meshes()) AddMesh(view);
+				return true;
 			}
+		}
 
-			meshes.push_back(std::make_shared<Mesh>(transform, trianglesNum, vertexIndices, verticesNum, 
-				vertices, normals, uvs, std::make_shared<Lambertian>(Color(0.89, 0.89, 0.89))));
+		std::vector<MeshData> parsed;
+		std::vector<std::string> libraries;
+		std::string error;
+		if (!ObjParser::Parse(reinterpret_cast<const char*>(source.Data()), source.Size(), parsed, libraries, parseThreads, error)) {
+			std::cerr << "Load Model Error: " << filename << ": " << error << '\n';
+			return false;
 		}
+		source.Close();
+		if (useCache) {
+			std::vector<MeshView> views(parsed.begin(), parsed.end());
+			if (!MeshCache::Write(cachePath.c_str(), sourceSize, sourceHash, views, libraries))
+				std::cerr << "Load Model Warning: the mesh cache of " << filename << " is not written.\n";
+		}
+		LoadMaterials(filename, libraries);
+		//the meshes take the parsed buffers over, one at a time so each is released on the way
+		for (auto& data : parsed) {
+			auto material = FindMaterial(data.material);
+			meshes.push_back(std::make_shared<Mesh>(transform, std::move(data), material));
+			data = MeshData();
+		}
+		return true;
+	}
+
+private:
+	//mtllib paths and the texture paths inside are relative to the OBJ's directory
+	void LoadMaterials(const char* filename, const std::vector<std::string>& libraries) {
+		std::string path(filename);
+		auto slash = path.find_last_of("/\\");
+		auto directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+		for (const auto& library : libraries)
+			materials->LoadLibrary(directory + library, directory, namedMaterials);
+	}
+
+	std::shared_ptr<Material> FindMaterial(const std::string& name) {
+		auto found = namedMaterials.find(name);
+		if (found != namedMaterials.end()) return found->second;
+		if (!name.empty()) std::cerr << "Load Model Warning: material " << name << " is not defined, using the default.\n";
+		namedMaterials[name] = materials->GetDefault();
+		return namedMaterials[name];
+	}
+
+	void AddMesh(const MeshView& view) {
+		meshes.push_back(std::make_shared<Mesh>(transform, view.trianglesNum, view.indices, view.verticesNum,
+			view.vertices, view.normals, view.uvs, FindMaterial(view.material)));
 	}
 
 public:
 	std::vector<std::shared_ptr<Mesh>> meshes;
 	std::shared_ptr<Transform> transform;
+	bool useCache;
+	uint32_t parseThreads;
+	std::shared_ptr<MaterialCache> materials;
+
+private:
+	std::unordered_map<std::string, std::shared_ptr<Material>> namedMaterials;
 };
\ No newline at end of file
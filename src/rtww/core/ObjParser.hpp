@@ -0,0 +1,440 @@
+#pragma once
+
+#include "Core.hpp"
+#include "MeshCache.hpp"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <string>
+#include <thread>
+
+//Multithreaded parser for the geometry of an OBJ file. The text is cut into one chunk
+//per thread at line boundaries and every thread parses its chunk into its own buffers.
+//The attribute arrays are then concatenated, and the threads resolve the face indices of
+//their chunk, relative ones included, against the merged arrays and triangulate in place.
+//Meshes read the corners straight from the chunks, which are released as soon as no
+//later mesh needs them.
+//Understands v, vt, vn, f, o/g and usemtl, which both start a new mesh, and mtllib;
+//every other statement is skipped. Quads are split along the shorter diagonal like tinyobjloader does, larger
+//polygons are fan triangulated.
+class ObjParser {
+public:
+	//threads 0: one per hardware thread. error is set when false is returned.
+	//Every mesh carries the name of its usemtl material, the mtllib files are returned in
+	//materialLibraries.
+	static bool Parse(const char* text, size_t size, std::vector<MeshData>& meshes, std::vector<std::string>& materialLibraries,
+		uint32_t threads, std::string& error);
+
+private:
+	static constexpr int Missing = INT_MIN;
+	//A relative index of the file is stored relative to its chunk plus this bias, which
+	//makes it negative, until the chunk's base is added. Keeps Corner at 12 bytes.
+	static constexpr int RelativeBias = INT_MIN / 2;
+
+	//Indices as 0 based positions in the merged arrays once resolved.
+	struct Corner {
+		int v, t, n;
+	};
+
+	//An o/g or usemtl statement, the first corner after it starts a new mesh.
+	struct Split {
+		size_t corner;
+		bool setsMaterial;
+		std::string material;
+	};
+
+	//A face of n corners takes the 3 * (n - 2) slots of its triangles in corners right
+	//away, the parsed corners first, so triangulation later works in place.
+	struct Chunk {
+		std::vector<Float> positions;	//xyz
+		std::vector<Float> texcoords;	//uv
+		std::vector<Float> normals;		//xyz
+		std::vector<Corner> corners;
+		std::vector<int> faceSizes;
+		std::vector<Split> splits;
+		std::vector<std::string> libraries;
+		size_t firstCorner = 0;			//in the corners of all chunks
+		int baseV = 0, baseT = 0, baseN = 0;
+		const char* errorAt = nullptr;
+		bool outOfRange = false;
+	};
+
+	static void ParseChunk(const char* begin, const char* end, Chunk& chunk);
+	//Exact buffer sizes of a chunk from a quick pass that only counts statements and face
+	//corners, so parsing never reallocates and the buffers carry no growth slack.
+	static void ReserveChunk(const char* begin, const char* end, Chunk& chunk);
+	static void Triangulate(Chunk& chunk, const std::vector<Float>& positions, int texcoordsNum, int normalsNum);
+	static void BuildMesh(const std::vector<Chunk>& chunks, size_t first, size_t last, const std::vector<Float>& positions,
+		const std::vector<Float>& texcoords, const std::vector<Float>& normals, std::vector<int>& firstVertexOf, MeshData& mesh);
+
+	static inline bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	static inline const char* SkipSpace(const char* p, const char* end) {
+		while (p < end && IsSpace(*p)) ++p;
+		return p;
+	}
+	static bool ParseFloat(const char*& p, const char* end, Float& value);
+	//One index of a face corner, 1 based or negative; Missing when the field is empty.
+	static bool ParseIndex(const char*& p, const char* end, int count, int& index);
+	static inline int Resolve(int index, int base) { return index < 0 && index != Missing ? index - RelativeBias + base : index; }
+};
+
+bool ObjParser::ParseFloat(const char*& p, const char* end, Float& value) {
+	p = SkipSpace(p, end);
+	if (p < end && *p == '+') ++p;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+bool ObjParser::ParseIndex(const char*& p, const char* end, int count, int& index) {
+	bool negative = p < end && *p == '-';
+	if (negative) ++p;
+	if (p >= end || *p < '0' || *p > '9') {
+		index = Missing;
+		return !negative;
+	}
+	int value = 0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+	if (value == 0 || (negative && value >= -RelativeBias)) return false;
+	index = negative ? count - value + RelativeBias : value - 1;
+	return true;
+}
+
+void ObjParser::ReserveChunk(const char* begin, const char* end, Chunk& chunk) {
+	size_t positionsNum = 0, texcoordsNum = 0, normalsNum = 0, facesNum = 0, cornersNum = 0;
+	const char* p = begin;
+	while (p < end) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (!lineEnd) lineEnd = end;
+		p = SkipSpace(p, lineEnd);
+		if (lineEnd - p >= 2 && IsSpace(p[1]) && (p[0] == 'v' || p[0] == 'f')) {
+			if (p[0] == 'v') ++positionsNum;
+			else {
+				int tokens = 0;
+				for (p += 2; p < lineEnd; ++p)
+					if (!IsSpace(*p) && IsSpace(p[-1])) ++tokens;
+				if (tokens >= 3) {
+					++facesNum;
+					cornersNum += 3 * (tokens - 2);
+				}
+			}
+		}
+		else if (lineEnd - p >= 3 && p[0] == 'v' && IsSpace(p[2])) {
+			texcoordsNum += p[1] == 't';
+			normalsNum += p[1] == 'n';
+		}
+		p = lineEnd + 1;
+	}
+	chunk.positions.reserve(3 * positionsNum);
+	chunk.texcoords.reserve(2 * texcoordsNum);
+	chunk.normals.reserve(3 * normalsNum);
+	chunk.faceSizes.reserve(facesNum);
+	chunk.corners.reserve(cornersNum);
+}
+
+void ObjParser::ParseChunk(const char* begin, const char* end, Chunk& chunk) {
+	ReserveChunk(begin, end, chunk);
+	const char* p = begin;
+	while (p < end) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (!lineEnd) lineEnd = end;
+		p = SkipSpace(p, lineEnd);
+		const char* line = p;
+
+		if (lineEnd - p >= 2 && p[0] == 'v' && IsSpace(p[1])) {
+			p += 2;
+			Float x, y, z;
+			if (!ParseFloat(p, lineEnd, x) || !ParseFloat(p, lineEnd, y) || !ParseFloat(p, lineEnd, z)) {
+				chunk.errorAt = line;
+				return;
+			}
+			chunk.positions.insert(chunk.positions.end(), { x, y, z });
+		}
+		else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+			p += 3;
+			Float u, v = 0;
+			if (!ParseFloat(p, lineEnd, u)) {
+				chunk.errorAt = line;
+				return;
+			}
+			ParseFloat(p, lineEnd, v);
+			chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+		}
+		else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) {
+			p += 3;
+			Float x, y, z;
+			if (!ParseFloat(p, lineEnd, x) || !ParseFloat(p, lineEnd, y) || !ParseFloat(p, lineEnd, z)) {
+				chunk.errorAt = line;
+				return;
+			}
+			chunk.normals.insert(chunk.normals.end(), { x, y, z });
+		}
+		else if (lineEnd - p >= 2 && p[0] == 'f' && IsSpace(p[1])) {
+			p += 2;
+			int positionsNum = static_cast<int>(chunk.positions.size() / 3);
+			int texcoordsNum = static_cast<int>(chunk.texcoords.size() / 2);
+			int normalsNum = static_cast<int>(chunk.normals.size() / 3);
+			size_t faceStart = chunk.corners.size();
+			int cornersNum = 0;
+			while ((p = SkipSpace(p, lineEnd)) < lineEnd) {
+				Corner c;
+				if (!ParseIndex(p, lineEnd, positionsNum, c.v) || c.v == Missing) {
+					chunk.errorAt = line;
+					return;
+				}
+				c.t = c.n = Missing;
+				if (p < lineEnd && *p == '/') {
+					++p;
+					if (!ParseIndex(p, lineEnd, texcoordsNum, c.t)) {
+						chunk.errorAt = line;
+						return;
+					}
+					if (p < lineEnd && *p == '/') {
+						++p;
+						if (!ParseIndex(p, lineEnd, normalsNum, c.n)) {
+							chunk.errorAt = line;
+							return;
+						}
+					}
+				}
+				chunk.corners.push_back(c);
+				++cornersNum;
+			}
+			if (cornersNum < 3) {
+				chunk.errorAt = line;
+				return;
+			}
+			chunk.faceSizes.push_back(cornersNum);
+			Corner last = chunk.corners.back();
+			chunk.corners.resize(faceStart + 3 * (cornersNum - 2), last);
+		}
+		else if (lineEnd - p >= 1 && (p[0] == 'o' || p[0] == 'g') && (lineEnd - p == 1 || IsSpace(p[1]))) {
+			chunk.splits.push_back({ chunk.corners.size(), false, std::string() });
+		}
+		else if (lineEnd - p >= 7 && memcmp(p, "usemtl", 6) == 0 && IsSpace(p[6])) {
+			auto nameEnd = lineEnd;
+			while (nameEnd > p + 7 && IsSpace(nameEnd[-1])) --nameEnd;
+			auto name = SkipSpace(p + 7, nameEnd);
+			chunk.splits.push_back({ chunk.corners.size(), true, std::string(name, nameEnd) });
+		}
+		else if (lineEnd - p >= 7 && memcmp(p, "mtllib", 6) == 0 && IsSpace(p[6])) {
+			for (p = SkipSpace(p + 7, lineEnd); p < lineEnd; p = SkipSpace(p, lineEnd)) {
+				auto nameEnd = p;
+				while (nameEnd < lineEnd && !IsSpace(*nameEnd)) ++nameEnd;
+				chunk.libraries.emplace_back(p, nameEnd);
+				p = nameEnd;
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+void ObjParser::Triangulate(Chunk& chunk, const std::vector<Float>& positions, int texcoordsNum, int normalsNum) {
+	int positionsNum = static_cast<int>(positions.size() / 3);
+	for (auto& c : chunk.corners) {
+		c.v = Resolve(c.v, chunk.baseV);
+		c.t = Resolve(c.t, chunk.baseT);
+		c.n = Resolve(c.n, chunk.baseN);
+		if (c.v < 0 || c.v >= positionsNum || (c.t != Missing && (c.t < 0 || c.t >= texcoordsNum))
+			|| (c.n != Missing && (c.n < 0 || c.n >= normalsNum))) {
+			chunk.outOfRange = true;
+			return;
+		}
+	}
+
+	auto distanceSquared = [&positions](const Corner& a, const Corner& b) {
+		Float dx = positions[3 * a.v + 0] - positions[3 * b.v + 0];
+		Float dy = positions[3 * a.v + 1] - positions[3 * b.v + 1];
+		Float dz = positions[3 * a.v + 2] - positions[3 * b.v + 2];
+		return dx * dx + dy * dy + dz * dz;
+	};
+
+	//faces only grow when triangulated, so going backwards never overwrites a face that is
+	//still to come
+	Corner quad[4];
+	std::vector<Corner> polygon;
+	size_t end = chunk.corners.size();
+	for (size_t f = chunk.faceSizes.size(); f-- > 0;) {
+		int size = chunk.faceSizes[f];
+		size_t start = end - 3 * (size - 2);
+		Corner* out = &chunk.corners[start];
+		if (size == 3) {}
+		else if (size == 4) {
+			std::copy(out, out + 4, quad);
+			if (distanceSquared(quad[0], quad[2]) < distanceSquared(quad[1], quad[3])) {
+				out[0] = quad[0]; out[1] = quad[1]; out[2] = quad[2];
+				out[3] = quad[0]; out[4] = quad[2]; out[5] = quad[3];
+			}
+			else {
+				out[0] = quad[0]; out[1] = quad[1]; out[2] = quad[3];
+				out[3] = quad[1]; out[4] = quad[2]; out[5] = quad[3];
+			}
+		}
+		else {
+			polygon.assign(out, out + size);
+			for (int k = 1; k + 1 < size; ++k, out += 3) {
+				out[0] = polygon[0];
+				out[1] = polygon[k];
+				out[2] = polygon[k + 1];
+			}
+		}
+		end = start;
+	}
+	chunk.faceSizes = std::vector<int>();
+}
+
+void ObjParser::BuildMesh(const std::vector<Chunk>& chunks, size_t first, size_t last, const std::vector<Float>& positions,
+	const std::vector<Float>& texcoords, const std::vector<Float>& normals, std::vector<int>& firstVertexOf, MeshData& mesh) {
+	//visits the corners [first, last) of all chunks in order
+	auto forEachCorner = [&chunks, first, last](auto&& visit) {
+		for (const auto& chunk : chunks) {
+			size_t begin = std::max(first, chunk.firstCorner), end = std::min(last, chunk.firstCorner + chunk.corners.size());
+			for (size_t i = begin; i < end; ++i) visit(chunk.corners[i - chunk.firstCorner]);
+		}
+	};
+
+	bool hasNormals = true, hasUVs = true;
+	forEachCorner([&](const Corner& c) {
+		hasNormals = hasNormals && c.n != Missing;
+		hasUVs = hasUVs && c.t != Missing;
+	});
+
+	//One vertex per distinct (position, normal, uv) tuple, attributes the mesh drops do
+	//not split vertices. The vertices of a position are chained from firstVertexOf, which
+	//is far smaller than a hash map and leaves the exact vertex count before any vertex
+	//array is allocated.
+	std::vector<Corner> vertexCorner;
+	std::vector<int> nextVertex;
+	mesh.indices.resize(last - first);
+	size_t index = 0;
+	forEachCorner([&](const Corner& c) {
+		int vertex = firstVertexOf[c.v];
+		for (; vertex >= 0; vertex = nextVertex[vertex]) {
+			const auto& other = vertexCorner[vertex];
+			if ((!hasUVs || other.t == c.t) && (!hasNormals || other.n == c.n)) break;
+		}
+		if (vertex < 0) {
+			vertex = static_cast<int>(vertexCorner.size());
+			vertexCorner.push_back(c);
+			nextVertex.push_back(firstVertexOf[c.v]);
+			firstVertexOf[c.v] = vertex;
+		}
+		mesh.indices[index++] = vertex;
+	});
+	nextVertex = std::vector<int>();
+
+	size_t verticesNum = vertexCorner.size();
+	mesh.vertices.resize(verticesNum);
+	if (hasUVs) mesh.uvs.resize(verticesNum);
+	if (hasNormals) mesh.normals.resize(verticesNum);
+	for (size_t k = 0; k < verticesNum; ++k) {
+		const auto& c = vertexCorner[k];
+		firstVertexOf[c.v] = -1;	//clean for the next mesh
+		mesh.vertices[k] = Point3f(positions[3 * c.v + 0], positions[3 * c.v + 1], positions[3 * c.v + 2]);
+		if (hasUVs) mesh.uvs[k] = Point2f(texcoords[2 * c.t + 0], 1.0f - texcoords[2 * c.t + 1]);
+		if (hasNormals) mesh.normals[k] = Vector3f(normals[3 * c.n + 0], normals[3 * c.n + 1], normals[3 * c.n + 2]);
+	}
+}
+
+bool ObjParser::Parse(const char* text, size_t size, std::vector<MeshData>& meshes, std::vector<std::string>& materialLibraries,
+	uint32_t threads, std::string& error) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	//chunks below a megabyte are not worth a thread
+	threads = static_cast<uint32_t>(std::max<size_t>(1, std::min<size_t>(threads, size >> 20)));
+
+	std::vector<const char*> bounds(threads + 1);
+	bounds[0] = text;
+	bounds[threads] = text + size;
+	for (uint32_t i = 1; i < threads; ++i) {
+		const char* cut = std::max(bounds[i - 1], text + size / threads * i);
+		auto newline = static_cast<const char*>(memchr(cut, '\n', text + size - cut));
+		bounds[i] = newline ? newline + 1 : text + size;
+	}
+
+	std::vector<Chunk> chunks(threads);
+	std::vector<std::thread> workers;
+	for (uint32_t i = 1; i < threads; ++i)
+		workers.emplace_back(ParseChunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+	ParseChunk(bounds[0], bounds[1], chunks[0]);
+	for (auto& worker : workers) worker.join();
+
+	for (const auto& chunk : chunks) {
+		if (chunk.errorAt) {
+			auto lineEnd = static_cast<const char*>(memchr(chunk.errorAt, '\n', text + size - chunk.errorAt));
+			error = "Malformed statement \"" + std::string(chunk.errorAt, lineEnd ? lineEnd : text + size) + "\"";
+			return false;
+		}
+	}
+
+	//concatenate the attributes, then resolve and triangulate every chunk on its thread
+	std::vector<Float> positions, texcoords, normals;
+	size_t positionsSize = 0, texcoordsSize = 0, normalsSize = 0;
+	for (auto& chunk : chunks) {
+		chunk.baseV = static_cast<int>(positionsSize / 3);
+		chunk.baseT = static_cast<int>(texcoordsSize / 2);
+		chunk.baseN = static_cast<int>(normalsSize / 3);
+		positionsSize += chunk.positions.size();
+		texcoordsSize += chunk.texcoords.size();
+		normalsSize += chunk.normals.size();
+	}
+	//a single chunk hands its buffers over, several are appended and released one by one
+	auto merge = [&chunks](std::vector<Float> Chunk::* member, std::vector<Float>& merged, size_t size) {
+		if (chunks.size() == 1) {
+			merged = std::move(chunks[0].*member);
+			return;
+		}
+		merged.reserve(size);
+		for (auto& chunk : chunks) {
+			merged.insert(merged.end(), (chunk.*member).begin(), (chunk.*member).end());
+			chunk.*member = std::vector<Float>();
+		}
+	};
+	merge(&Chunk::positions, positions, positionsSize);
+	merge(&Chunk::texcoords, texcoords, texcoordsSize);
+	merge(&Chunk::normals, normals, normalsSize);
+
+	int texcoordsNum = static_cast<int>(texcoords.size() / 2), normalsNum = static_cast<int>(normals.size() / 3);
+	workers.clear();
+	for (uint32_t i = 1; i < threads; ++i)
+		workers.emplace_back(Triangulate, std::ref(chunks[i]), std::cref(positions), texcoordsNum, normalsNum);
+	Triangulate(chunks[0], positions, texcoordsNum, normalsNum);
+	for (auto& worker : workers) worker.join();
+
+	//a mesh ends at every split, the material carries over the o/g statements
+	std::vector<Split> splits;
+	size_t cornersNum = 0;
+	for (auto& chunk : chunks) {
+		if (chunk.outOfRange) {
+			error = "Face index out of range";
+			return false;
+		}
+		chunk.firstCorner = cornersNum;
+		for (auto& split : chunk.splits) {
+			split.corner += cornersNum;
+			splits.push_back(std::move(split));
+		}
+		for (auto& library : chunk.libraries)
+			if (std::find(materialLibraries.begin(), materialLibraries.end(), library) == materialLibraries.end())
+				materialLibraries.push_back(std::move(library));
+		cornersNum += chunk.corners.size();
+	}
+	splits.push_back({ cornersNum, false, std::string() });
+
+	std::vector<int> firstVertexOf(positions.size() / 3, -1);
+	size_t meshStart = 0;
+	std::string material;
+	for (auto& split : splits) {
+		if (split.corner > meshStart) {
+			meshes.emplace_back();
+			meshes.back().material = material;
+			BuildMesh(chunks, meshStart, split.corner, positions, texcoords, normals, firstVertexOf, meshes.back());
+			//release the chunks no later mesh reads
+			for (auto& chunk : chunks)
+				if (chunk.firstCorner + chunk.corners.size() <= split.corner) chunk.corners = std::vector<Corner>();
+			meshStart = split.corner;
+		}
+		if (split.setsMaterial) material = std::move(split.material);
+	}
+	return true;
+}
@@ -12,7 +12,7 @@ public:
 	Vector3f v() const { return axis[1]; }
 	Vector3f w() const { return axis[2]; }
 
-	Vector3f Local(double a, double b, double c) const {
+	Vector3f Local(Float a, Float b, Float c) const {
 		return a * u() + b * v() + c * w();
 	}
 
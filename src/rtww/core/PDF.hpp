@@ -7,22 +7,30 @@ class PDF {
 public:
 	virtual ~PDF() {}
 
-	virtual double Value(const Vector3f& direction) const = 0;
-	virtual Vector3f Generate() const = 0;
+	virtual Float Value(const Vector3f& direction) const = 0;
+	virtual Vector3f Generate() const { return Generate(Point2f(Random<Float>(), Random<Float>())); }
+	//u is a 2D sample in [0,1)^2 from a Sampler
+	virtual Vector3f Generate(const Point2f& u) const = 0;
 };
 
 
+//Veach's power heuristic (beta = 2) weight for a sample drawn from f
+inline Float PowerHeuristic(Float fPdf, Float gPdf) {
+	auto f = fPdf * fPdf, g = gPdf * gPdf;
+	return f + g > 0 ? f / (f + g) : 0;
+}
+
 class CosinePDF : public PDF {
 public:
 	CosinePDF(const Vector3f& w) { uvw.BuildFromW(w); }
 
-	virtual double Value(const Vector3f& direction) const override {
+	virtual Float Value(const Vector3f& direction) const override {
 		auto cosine = Dot(direction.Normalize(), uvw.w());
 		return (cosine <= 0) ? 0 : cosine / Pi;
 	}
 
-	virtual Vector3f Generate() const override {
-		return uvw.Local(RandomCosineDirection());
+	virtual Vector3f Generate(const Point2f& u) const override {
+		return uvw.Local(RandomCosineDirection(u.x, u.y));
 	}
 
 public:
@@ -34,12 +42,12 @@ class ShapePDF : public PDF {
 public:
 	ShapePDF(std::shared_ptr<Shape> p, const Point3f& origin) : ptr(p), o(origin) {}
 
-	virtual double Value(const Vector3f& direction) const override {
+	virtual Float Value(const Vector3f& direction) const override {
 		return ptr->PDFValue(o, direction);
 	}
 
-	virtual Vector3f Generate() const override {
-		return ptr->ShapeRandom(o);
+	virtual Vector3f Generate(const Point2f& u) const override {
+		return ptr->ShapeRandom(o, u);
 	}
 
 public:
@@ -55,15 +63,16 @@ public:
 		p[1] = p1;
 	}
 
-	virtual double Value(const Vector3f& direction) const override {
+	virtual Float Value(const Vector3f& direction) const override {
 		return 0.5 * p[0]->Value(direction) + 0.5 *p[1]->Value(direction);
 	}
 
-	virtual Vector3f Generate() const override {
-		if (Random<Float>() < 0.5)
-			return p[0]->Generate();
+	virtual Vector3f Generate(const Point2f& u) const override {
+		//reuse u.x for the choice and stretch it back to [0,1)
+		if (u.x < 0.5)
+			return p[0]->Generate(Point2f(2 * u.x, u.y));
 		else
-			return p[1]->Generate();
+			return p[1]->Generate(Point2f(2 * u.x - 1, u.y));
 	}
 
 public:
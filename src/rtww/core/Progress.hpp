@@ -0,0 +1,197 @@
+#pragma once
+
+#include "Core.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <iomanip>
+
+enum class ProgressMode {
+	Normal,		//human readable line every interval
+	Quiet,		//only the per-frame summary
+	JsonLines	//one JSON object per line, for log scrapers
+};
+
+std::string FormatDuration(Float seconds) {
+	auto total = static_cast<long long>(seconds < 0 ? 0 : seconds);
+	auto hours = total / 3600;
+	auto minutes = total % 3600 / 60;
+	auto secs = total % 60;
+	std::stringstream ss;
+	if (hours > 0) ss << hours << "h";
+	if (hours > 0 || minutes > 0) ss << minutes << "m";
+	ss << secs << "s";
+	return ss.str();
+}
+
+//Per-thread path counters, merged into FrameProgress once per work unit.
+struct PathStats {
+	uint64_t paths = 0;
+	uint64_t segments = 0;
+	uint64_t terminated = 0;	//ended by Russian roulette
+	//wavefront engine only: secondary rays traced, the time spent tracing and sorting them
+	uint64_t secondaryRays = 0;
+	uint64_t secondaryNanoseconds = 0;
+	uint64_t sortNanoseconds = 0;
+};
+
+//Written by the render workers, read by the reporter thread. Workers only ever
+//touch two relaxed atomics, so progress accounting never serializes them.
+struct FrameProgress {
+	std::atomic<uint64_t> workDone{ 0 };
+	std::atomic<uint64_t> raysTraced{ 0 };
+	std::atomic<uint64_t> paths{ 0 };
+	std::atomic<uint64_t> pathSegments{ 0 };
+	std::atomic<uint64_t> rouletteTerminated{ 0 };
+	std::atomic<uint64_t> secondaryRays{ 0 };
+	std::atomic<uint64_t> secondaryNanoseconds{ 0 };
+	std::atomic<uint64_t> sortNanoseconds{ 0 };
+	//atomic too: progressive rendering resets the total while the reporter already runs
+	std::atomic<uint64_t> workTotal{ 0 };
+
+	void Reset(uint64_t total) {
+		workTotal.store(total, std::memory_order_relaxed);
+		workDone.store(0, std::memory_order_relaxed);
+		raysTraced.store(0, std::memory_order_relaxed);
+		paths.store(0, std::memory_order_relaxed);
+		pathSegments.store(0, std::memory_order_relaxed);
+		rouletteTerminated.store(0, std::memory_order_relaxed);
+		secondaryRays.store(0, std::memory_order_relaxed);
+		secondaryNanoseconds.store(0, std::memory_order_relaxed);
+		sortNanoseconds.store(0, std::memory_order_relaxed);
+	}
+
+	void AddWork(uint64_t units, uint64_t rays) {
+		raysTraced.fetch_add(rays, std::memory_order_relaxed);
+		workDone.fetch_add(units, std::memory_order_relaxed);
+	}
+
+	void AddPaths(const PathStats& stats) {
+		paths.fetch_add(stats.paths, std::memory_order_relaxed);
+		pathSegments.fetch_add(stats.segments, std::memory_order_relaxed);
+		rouletteTerminated.fetch_add(stats.terminated, std::memory_order_relaxed);
+		secondaryRays.fetch_add(stats.secondaryRays, std::memory_order_relaxed);
+		secondaryNanoseconds.fetch_add(stats.secondaryNanoseconds, std::memory_order_relaxed);
+		sortNanoseconds.fetch_add(stats.sortNanoseconds, std::memory_order_relaxed);
+	}
+};
+
+class ProgressReporter {
+public:
+	ProgressReporter(ProgressMode mode = ProgressMode::Normal, uint32_t intervalMs = 1000)
+		: mode(mode), intervalMs(intervalMs) {}
+	~ProgressReporter() { Stop(); }
+
+	void Start(uint32_t frameIndex, FrameProgress* frameProgress);
+	void Stop();
+	//Camera rays actually traced against the fixed samplesPerPixel budget
+	void ReportSampling(uint32_t frameIndex, uint64_t used, uint64_t budget) const;
+
+private:
+	void Run();
+	void Report(bool final);
+
+public:
+	ProgressMode mode;
+	uint32_t intervalMs;
+
+private:
+	uint32_t frame = 0;
+	FrameProgress* progress = nullptr;
+	std::chrono::steady_clock::time_point start;
+	std::thread worker;
+	std::mutex waitMutex;
+	std::condition_variable wakeUp;
+	bool stop = false;
+};
+
+void ProgressReporter::Start(uint32_t frameIndex, FrameProgress* frameProgress) {
+	Stop();
+	frame = frameIndex;
+	progress = frameProgress;
+	start = std::chrono::steady_clock::now();
+	stop = false;
+	if (mode == ProgressMode::JsonLines)
+		std::cerr << "{\"event\":\"frame_start\",\"frame\":" << frame << "}\n" << std::flush;
+	else if (mode == ProgressMode::Normal)
+		std::cerr << "The frame " << frame << " starts rendering.\n" << std::flush;
+	if (mode != ProgressMode::Quiet)
+		worker = std::thread(&ProgressReporter::Run, this);
+}
+
+void ProgressReporter::Stop() {
+	if (!progress) return;
+	{
+		std::unique_lock<std::mutex> lock(waitMutex);
+		stop = true;
+	}
+	wakeUp.notify_all();
+	if (worker.joinable()) worker.join();
+	Report(true);
+	progress = nullptr;
+}
+
+void ProgressReporter::Run() {
+	std::unique_lock<std::mutex> lock(waitMutex);
+	while (!wakeUp.wait_for(lock, std::chrono::milliseconds(intervalMs), [this] { return stop; }))
+		Report(false);
+}
+
+void ProgressReporter::Report(bool final) {
+	auto done = progress->workDone.load(std::memory_order_relaxed);
+	auto rays = progress->raysTraced.load(std::memory_order_relaxed);
+	auto total = progress->workTotal.load(std::memory_order_relaxed);
+	Float elapsed = std::chrono::duration<Float>(std::chrono::steady_clock::now() - start).count();
+	Float fraction = total > 0 ? Float(done) / total : 1;
+	Float mrays = elapsed > 0 ? rays / elapsed * 1e-6 : 0;
+	Float eta = fraction > 0 ? elapsed * (1 - fraction) / fraction : 0;
+	auto paths = progress->paths.load(std::memory_order_relaxed);
+	Float pathLength = paths > 0 ? Float(progress->pathSegments.load(std::memory_order_relaxed)) / paths : 0;
+	auto terminated = progress->rouletteTerminated.load(std::memory_order_relaxed);
+	auto secondary = progress->secondaryRays.load(std::memory_order_relaxed);
+	//per thread rate: the time is summed over the workers
+	auto secondarySeconds = progress->secondaryNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+	Float secondaryMrays = secondarySeconds > 0 ? secondary / secondarySeconds * 1e-6 : 0;
+	Float sortMs = progress->sortNanoseconds.load(std::memory_order_relaxed) * 1e-6;
+
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(2);
+	if (mode == ProgressMode::JsonLines) {
+		ss << "{\"event\":\"" << (final ? "frame_end" : "progress") << "\",\"frame\":" << frame
+			<< ",\"percent\":" << 100 * fraction << ",\"mrays_per_s\":" << mrays
+			<< ",\"elapsed_s\":" << elapsed << ",\"eta_s\":" << eta << ",\"rays\":" << rays
+			<< ",\"avg_path_length\":" << pathLength << ",\"roulette_terminated\":" << terminated
+			<< ",\"secondary_rays\":" << secondary << ",\"secondary_mrays_per_thread_s\":" << secondaryMrays
+			<< ",\"sort_ms\":" << sortMs << "}\n";
+	}
+	else if (final) {
+		ss << "The frame " << frame << " rendering is complete.Total time: " << FormatDuration(elapsed)
+			<< " (" << mrays << " Mrays/s, average path length " << pathLength << ", "
+			<< terminated << " paths ended by roulette)\n";
+		if (secondary > 0)
+			ss << "Secondary rays: " << secondary << " at " << secondaryMrays << " Mrays/s per thread, "
+				<< sortMs << " ms thread time sorting\n";
+	}
+	else {
+		ss << "Frame " << frame << ": " << 100 * fraction << "% | " << mrays << " Mrays/s | ETA "
+			<< FormatDuration(eta) << "\n";
+	}
+	std::cerr << ss.str() << std::flush;
+}
+
+void ProgressReporter::ReportSampling(uint32_t frameIndex, uint64_t used, uint64_t budget) const {
+	auto saved = static_cast<long long>(budget) - static_cast<long long>(used);
+	Float percent = budget > 0 ? 100.0f * saved / budget : 0;
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(2);
+	if (mode == ProgressMode::JsonLines)
+		ss << "{\"event\":\"sampling\",\"frame\":" << frameIndex << ",\"rays\":" << used
+			<< ",\"budget\":" << budget << ",\"saved\":" << saved << ",\"saved_percent\":" << percent << "}\n";
+	else
+		ss << "Frame " << frameIndex << " adaptive sampling: " << used << " of " << budget
+			<< " camera rays, " << saved << " saved (" << percent << "%)\n";
+	std::cerr << ss.str() << std::flush;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Core.hpp"
+#include "AABB.hpp"
+
+//Up to MaxSize rays traced together through the BVH, e.g. neighbouring camera rays or
+//shadow rays from nearby points. When every direction has the same sign per axis the
+//packet is coherent and keeps interval bounds on its origins and inverse directions,
+//so a node the whole packet misses is culled with one interval test instead of one
+//slab test per ray.
+struct RayPacket {
+	static constexpr int MaxSize = 16;
+
+	void Clear() {
+		size = 0;
+		coherent = false;
+	}
+
+	inline void Add(const Ray& r) {
+		rays[size] = r;
+		invDirections[size] = Vector3f(1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z);
+		++size;
+	}
+
+	//Computes the interval bounds, call once after the last Add.
+	void Finalize();
+
+	uint32_t FullMask() const { return size >= 32 ? ~0u : (1u << size) - 1; }
+
+	//Conservative: true only when no ray of the packet can hit box within [tMin, tMax].
+	bool Misses(const AABB& box, Float tMin, Float tMax) const;
+	//Slab test of ray i with its precomputed inverse direction.
+	bool Hits(int i, const AABB& box, Float tMin, Float tMax) const;
+
+private:
+	static inline Float ProductMin(Float a0, Float a1, Float b0, Float b1) {
+		return std::min({ a0 * b0, a0 * b1, a1 * b0, a1 * b1 });
+	}
+	static inline Float ProductMax(Float a0, Float a1, Float b0, Float b1) {
+		return std::max({ a0 * b0, a0 * b1, a1 * b0, a1 * b1 });
+	}
+
+public:
+	int size = 0;
+	Ray rays[MaxSize];
+	Vector3f invDirections[MaxSize];
+	bool coherent = false;
+	Point3f originMin, originMax;
+	Vector3f invDirMin, invDirMax;
+};
+
+void RayPacket::Finalize() {
+	coherent = size > 0;
+	for (int a = 0; a < 3 && coherent; ++a) {
+		originMin[a] = originMax[a] = rays[0].origin[a];
+		invDirMin[a] = invDirMax[a] = invDirections[0][a];
+		bool positive = rays[0].direction[a] > 0;
+		for (int i = 0; i < size; ++i) {
+			auto d = rays[i].direction[a];
+			//a zero or sign changing component makes the inverse direction interval unbounded
+			if (d == 0 || (d > 0) != positive) {
+				coherent = false;
+				break;
+			}
+			originMin[a] = std::min(originMin[a], rays[i].origin[a]);
+			originMax[a] = std::max(originMax[a], rays[i].origin[a]);
+			invDirMin[a] = std::min(invDirMin[a], invDirections[i][a]);
+			invDirMax[a] = std::max(invDirMax[a], invDirections[i][a]);
+		}
+	}
+}
+
+bool RayPacket::Misses(const AABB& box, Float tMin, Float tMax) const {
+	if (!coherent) return false;
+	Float nearLow = tMin, farHigh = tMax;
+	for (int a = 0; a < 3; ++a) {
+		auto slabNear = box.Min()[a], slabFar = box.Max()[a];
+		if (invDirMin[a] < 0) std::swap(slabNear, slabFar);
+		//t = (slab - o) * invD over every o and invD of the packet
+		nearLow = std::max(nearLow, ProductMin(slabNear - originMax[a], slabNear - originMin[a], invDirMin[a], invDirMax[a]));
+		farHigh = std::min(farHigh, ProductMax(slabFar - originMax[a], slabFar - originMin[a], invDirMin[a], invDirMax[a]));
+		if (farHigh < nearLow) return true;
+	}
+	return false;
+}
+
+bool RayPacket::Hits(int i, const AABB& box, Float tMin, Float tMax) const {
+	const auto& r = rays[i];
+	for (int a = 0; a < 3; ++a) {
+		auto invD = invDirections[i][a];
+		auto t0 = (box.Min()[a] - r.origin[a]) * invD;
+		auto t1 = (box.Max()[a] - r.origin[a]) * invD;
+		if (invD < 0.0f) std::swap(t0, t1);
+		tMin = t0 > tMin ? t0 : tMin;
+		tMax = t1 < tMax ? t1 : tMax;
+		if (tMax <= tMin) return false;
+	}
+	return true;
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "Core.hpp"
+#include <memory>
+
+enum class SamplerType {
+	Independent,	//uniform Random<Float>(), the old behavior
+	Stratified,		//jittered strata, shuffled per dimension
+	Halton,			//radical inverse in prime bases, Cranley-Patterson rotated per pixel
+	Sobol			//padded 2D Sobol (0,2)-sequence with Owen scrambling
+};
+
+inline uint64_t MixBits(uint64_t v) {
+	v ^= (v >> 31);
+	v *= 0x7fb5d329728ea185ULL;
+	v ^= (v >> 27);
+	v *= 0x81dadef4bc2dd44dULL;
+	v ^= (v >> 33);
+	return v;
+}
+
+inline uint64_t HashSample(uint64_t a, uint64_t b, uint64_t c = 0, uint64_t d = 0) {
+	return MixBits(MixBits(MixBits(MixBits(a) ^ b) ^ c) ^ d);
+}
+
+inline Float HashFloat(uint64_t hash) {
+	return Float(hash >> 40) * Float(0x1p-24);
+}
+
+inline uint32_t ReverseBits32(uint32_t v) {
+	v = (v << 16) | (v >> 16);
+	v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+	v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+	v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+	v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+	return v;
+}
+
+//Nested uniform (Owen) scramble of the bits of v, hash based (Laine-Karras / Burley).
+inline uint32_t OwenScramble(uint32_t v, uint32_t seed) {
+	v = ReverseBits32(v);
+	v ^= v * 0x3d20adea;
+	v += seed;
+	v *= (seed >> 16) | 1;
+	v ^= v * 0x05526c56;
+	v ^= v * 0x53a22864;
+	return ReverseBits32(v);
+}
+
+inline Float UIntToUnitFloat(uint32_t v) {
+	return std::min(Float(v) * Float(0x1p-32), Float(1) - std::numeric_limits<Float>::epsilon());
+}
+
+//Element i of a pseudo random permutation of [0, n) (Kensler, "Correlated Multi-Jittered Sampling").
+inline uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t seed) {
+	uint32_t w = n - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do {
+		i ^= seed;
+		i *= 0xe170893d;
+		i ^= seed >> 16;
+		i ^= (i & w) >> 4;
+		i ^= seed >> 8;
+		i *= 0x0929eb3f;
+		i ^= seed >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | seed >> 27;
+		i *= 0x6935fa69;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= n);
+	return (i + seed) % n;
+}
+
+//Samples are requested per pixel sample in a fixed order: Get2D for the pixel
+//jitter, Get2D for the lens, then one Get2D (plus any Get1D) per bounce. Each
+//call consumes the next dimension, so the same index always gets the same
+//sample pattern no matter how many threads share the frame.
+class Sampler {
+public:
+	Sampler(uint32_t samplesPerPixel, uint32_t seed) : samplesPerPixel(samplesPerPixel), seed(seed) {}
+	virtual ~Sampler() {}
+
+	//dim resumes a sample part way through its dimensions, e.g. a path suspended in a wavefront queue
+	virtual void StartPixelSample(const Point2i& p, uint32_t index, uint32_t dim = 0) {
+		pixel = p;
+		sampleIndex = index;
+		dimension = dim;
+	}
+
+	uint32_t Dimension() const { return dimension; }
+
+	virtual Float Get1D() = 0;
+	virtual Point2f Get2D() = 0;
+
+protected:
+	inline uint64_t PixelHash(uint32_t dim) const {
+		return HashSample(uint64_t(uint32_t(pixel.x)) << 32 | uint32_t(pixel.y), dim, seed);
+	}
+
+public:
+	uint32_t samplesPerPixel;
+	uint32_t seed;
+
+protected:
+	Point2i pixel;
+	uint32_t sampleIndex = 0;
+	uint32_t dimension = 0;
+};
+
+class IndependentSampler : public Sampler {
+public:
+	IndependentSampler(uint32_t samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+	virtual Float Get1D() override { return Random<Float>(); }
+	virtual Point2f Get2D() override { return Point2f(Random<Float>(), Random<Float>()); }
+};
+
+class StratifiedSampler : public Sampler {
+public:
+	StratifiedSampler(uint32_t samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {
+		gridSize = std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(Float(samplesPerPixel))));
+	}
+
+	virtual Float Get1D() override {
+		auto hash = PixelHash(dimension++);
+		uint32_t n = std::max<uint32_t>(1, samplesPerPixel);
+		//indices past samplesPerPixel (adaptive/progressive) start a freshly shuffled round of strata
+		auto stratum = PermutationElement(sampleIndex % n, n, uint32_t(hash) + sampleIndex / n);
+		return (stratum + HashFloat(HashSample(hash, sampleIndex, 1))) / n;
+	}
+
+	virtual Point2f Get2D() override {
+		auto hash = PixelHash(dimension);
+		dimension += 2;
+		uint32_t n = gridSize * gridSize;
+		auto stratum = PermutationElement(sampleIndex % n, n, uint32_t(hash) + sampleIndex / n);
+		auto x = stratum % gridSize, y = stratum / gridSize;
+		return Point2f((x + HashFloat(HashSample(hash, sampleIndex, 1))) / gridSize,
+			(y + HashFloat(HashSample(hash, sampleIndex, 2))) / gridSize);
+	}
+
+private:
+	uint32_t gridSize;
+};
+
+class HaltonSampler : public Sampler {
+public:
+	HaltonSampler(uint32_t samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+	virtual Float Get1D() override {
+		auto dim = dimension++;
+		return Sample(dim);
+	}
+
+	virtual Point2f Get2D() override {
+		auto dim = dimension;
+		dimension += 2;
+		return Point2f(Sample(dim), Sample(dim + 1));
+	}
+
+private:
+	static Float RadicalInverse(uint32_t base, uint64_t a) {
+		const Float invBase = Float(1) / base;
+		uint64_t reversedDigits = 0;
+		Float invBaseN = 1;
+		while (a) {
+			uint64_t next = a / base;
+			uint64_t digit = a - next * base;
+			reversedDigits = reversedDigits * base + digit;
+			invBaseN *= invBase;
+			a = next;
+		}
+		return std::min(reversedDigits * invBaseN, Float(1) - std::numeric_limits<Float>::epsilon());
+	}
+
+	Float Sample(uint32_t dim) const {
+		auto hash = PixelHash(dim);
+		//beyond the prime table the sequence degrades to hashed independent samples
+		if (dim >= primeCount) return HashFloat(HashSample(hash, sampleIndex));
+		//skip the first sample, radical inverse of 0 is 0 in every base
+		Float value = RadicalInverse(primes[dim], uint64_t(sampleIndex) + 1) + HashFloat(hash);
+		return value >= 1 ? value - 1 : value;
+	}
+
+	static constexpr uint32_t primeCount = 32;
+	static constexpr uint32_t primes[primeCount] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131 };
+};
+
+constexpr uint32_t HaltonSampler::primes[HaltonSampler::primeCount];
+
+//Every dimension pair uses the first two Sobol dimensions (a (0,2)-sequence),
+//decorrelated from other pairs by Owen scrambling the sample index and the
+//sample values with per pixel, per dimension seeds.
+class SobolSampler : public Sampler {
+public:
+	SobolSampler(uint32_t samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+	virtual Float Get1D() override {
+		auto hash = PixelHash(dimension++);
+		auto index = OwenScramble(sampleIndex, uint32_t(hash));
+		return UIntToUnitFloat(OwenScramble(ReverseBits32(index), uint32_t(hash >> 32)));
+	}
+
+	virtual Point2f Get2D() override {
+		auto hash = PixelHash(dimension);
+		dimension += 2;
+		auto index = OwenScramble(sampleIndex, uint32_t(hash));
+		auto seed1 = uint32_t(MixBits(hash));
+		return Point2f(UIntToUnitFloat(OwenScramble(ReverseBits32(index), uint32_t(hash >> 32))),
+			UIntToUnitFloat(OwenScramble(SobolSecondDimension(index), seed1)));
+	}
+
+private:
+	static uint32_t SobolSecondDimension(uint32_t a) {
+		uint32_t result = 0;
+		for (uint32_t v = 1u << 31; a; a >>= 1, v ^= v >> 1)
+			if (a & 1) result ^= v;
+		return result;
+	}
+};
+
+std::shared_ptr<Sampler> CreateSampler(SamplerType type, uint32_t samplesPerPixel, uint32_t seed = 0) {
+	switch (type) {
+	case SamplerType::Stratified: return std::make_shared<StratifiedSampler>(samplesPerPixel, seed);
+	case SamplerType::Halton: return std::make_shared<HaltonSampler>(samplesPerPixel, seed);
+	case SamplerType::Sobol: return std::make_shared<SobolSampler>(samplesPerPixel, seed);
+	default: return std::make_shared<IndependentSampler>(samplesPerPixel, seed);
+	}
+}
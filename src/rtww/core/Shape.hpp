@@ -3,6 +3,7 @@
 #include "Core.hpp"
 #include "AABB.hpp"
 #include "Transform.hpp"
+#include "RayPacket.hpp"
 
 class Material;
 
@@ -14,19 +15,89 @@ struct IntersectionRecord {
 	Float u;
 	Float v;
 	bool isFrontFace;
+	Vector3f dpdu, dpdv;	//world space, zero when the shape has no uv parameterization
+	Float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;	//uv change to the neighbouring pixels
 
 	inline void SetFaceNormal(const Ray& r, const Vector3f& outwardNormal) {
 		isFrontFace = Dot(r.direction, outwardNormal) < 0;
 		normal = isFrontFace ? outwardNormal : -outwardNormal;
 	}
+
+	//Intersects the differential rays with the tangent plane of the hit and solves for the
+	//uv offsets of those points in least squares, as pbrt does.
+	void ComputeDifferentials(const RayDifferential& differential);
+	void ClearDifferentials() { dudx = dvdx = dudy = dvdy = 0; }
+
+	//Ray leaving the hit point in direction d, see OffsetRayOrigin.
+	inline Ray SpawnRay(const Vector3f& d, Float t) const {
+		return Ray(OffsetRayOrigin(hitPoint, normal, d), d, t);
+	}
+};
+
+//Closest hits of a RayPacket; tMax[i] shrinks as closer hits of ray i are found.
+struct PacketHits {
+	IntersectionRecord records[RayPacket::MaxSize];
+	Float tMax[RayPacket::MaxSize];
+	uint32_t mask = 0;	//bit i set: ray i hit something
+
+	void Reset(int size, Float t) {
+		for (int i = 0; i < size; ++i) tMax[i] = t;
+		mask = 0;
+	}
+
+	Float MaxDistance(int size, uint32_t active) const {
+		Float t = 0;
+		for (int i = 0; i < size; ++i)
+			if ((active >> i) & 1) t = std::max(t, tMax[i]);
+		return t;
+	}
 };
 
+void IntersectionRecord::ComputeDifferentials(const RayDifferential& differential) {
+	ClearDifferentials();
+	Float d = Dot(normal, Convert(hitPoint));
+	Float tx = (d - Dot(normal, Convert(differential.rxOrigin))) / Dot(normal, differential.rxDirection);
+	Float ty = (d - Dot(normal, Convert(differential.ryOrigin))) / Dot(normal, differential.ryDirection);
+	if (!std::isfinite(tx) || !std::isfinite(ty)) return;
+	Vector3f dpdx = differential.rxOrigin + tx * differential.rxDirection - hitPoint;
+	Vector3f dpdy = differential.ryOrigin + ty * differential.ryDirection - hitPoint;
+
+	Float ata00 = Dot(dpdu, dpdu), ata01 = Dot(dpdu, dpdv), ata11 = Dot(dpdv, dpdv);
+	Float invDet = 1 / (ata00 * ata11 - ata01 * ata01);
+	if (!std::isfinite(invDet)) return;
+	Float atb0x = Dot(dpdu, dpdx), atb1x = Dot(dpdv, dpdx);
+	Float atb0y = Dot(dpdu, dpdy), atb1y = Dot(dpdv, dpdy);
+	auto clamp = [](Float x) { return std::isfinite(x) ? Clamp<Float>(x, -1e8f, 1e8f) : 0; };
+	dudx = clamp((ata11 * atb0x - ata01 * atb1x) * invDet);
+	dvdx = clamp((ata00 * atb1x - ata01 * atb0x) * invDet);
+	dudy = clamp((ata11 * atb0y - ata01 * atb1y) * invDet);
+	dvdy = clamp((ata00 * atb1y - ata01 * atb0y) * invDet);
+}
+
 class Shape {
 public:
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec)const = 0;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const = 0;
+	//Traces the rays of packet selected by active, the default goes one ray at a time.
+	virtual void IntersectionPacket(const RayPacket& packet, Float tMin, uint32_t active, PacketHits& hits) const;
+	virtual Float Area() const { return 0.0; }
+	virtual std::shared_ptr<Material> GetMaterial() const { return nullptr; }
+	//Composite shapes hand out their children so the scene can be searched for lights.
+	virtual void GetChildren(std::vector<std::shared_ptr<Shape>>& children) const {}
+	//True when PDFValue and ShapeRandom are implemented, i.e. the shape can be a sampled light.
+	virtual bool IsSamplable() const { return false; }
 	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const { return 0.0; }
-	virtual Vector3f ShapeRandom(const Point3f& o) const { return Vector3f(1, 0, 0); }
+	Vector3f ShapeRandom(const Point3f& o) const { return ShapeRandom(o, Point2f(Random<Float>(), Random<Float>())); }
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const { return Vector3f(1, 0, 0); }
 protected:
 	std::shared_ptr<Transform> transform;
-};
\ No newline at end of file
+};
+
+void Shape::IntersectionPacket(const RayPacket& packet, Float tMin, uint32_t active, PacketHits& hits) const {
+	for (int i = 0; i < packet.size; ++i) {
+		if (((active >> i) & 1) && Intersection(packet.rays[i], tMin, hits.tMax[i], hits.records[i])) {
+			hits.tMax[i] = hits.records[i].time;
+			hits.mask |= 1u << i;
+		}
+	}
+}
@@ -1,13 +1,49 @@
 #pragma once
 #include "Core.hpp"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "Shape.hpp"
+#include "TextureCache.hpp"
+#include "TexturePageCache.hpp"
 
 class Texture {
 public:
 	virtual Color Value(Float u, Float v, const Point3f& p) const = 0;
+	//Value filtered over the pixel footprint of the hit, see IntersectionRecord::ComputeDifferentials.
+	virtual Color FilteredValue(const IntersectionRecord& rec) const { return Value(rec.u, rec.v, rec.hitPoint); }
 };
 
+//Bilinear filter of a width x height image at (u, v), v up. footprint(i0, i1, j0, j1, c)
+//fills c with the 0-255 colors of the texels (i0, j0), (i1, j0), (i0, j1), (i1, j1),
+//all inside the image, so the whole 2x2 footprint is addressed in one go.
+template <typename Footprint>
+Color BilinearLookup(int width, int height, Float u, Float v, Footprint footprint) {
+	Float x = Clamp<Float>(u, 0.0, 1.0) * width - 0.5f;
+	Float y = (1.0f - Clamp<Float>(v, 0.0, 1.0)) * height - 0.5f;
+	//x, y >= -0.5, so truncating one above is the floor without a libm call
+	int i = static_cast<int>(x + 1) - 1, j = static_cast<int>(y + 1) - 1;
+	Float fx = x - i, fy = y - j;
+	Color c[4];
+	footprint(Clamp(i, 0, width - 1), Clamp(i + 1, 0, width - 1), Clamp(j, 0, height - 1), Clamp(j + 1, 0, height - 1), c);
+	const auto colorScale = 1.0 / 256.0;
+	return colorScale * ((1 - fy) * ((1 - fx) * c[0] + fx * c[1]) + fy * ((1 - fx) * c[2] + fx * c[3]));
+}
+
+//Trilinear: the mip level whose texels match the larger uv footprint of rec on the
+//width x height level 0, blended with the next one. bilinear(level) filters one level.
+//Without differentials this is bilinear at full size.
+template <typename Bilinear>
+Color TrilinearLookup(const IntersectionRecord& rec, int width, int height, int levelCount, Bilinear bilinear) {
+	Float footprint = std::max(std::max(std::abs(rec.dudx), std::abs(rec.dudy)) * width,
+		std::max(std::abs(rec.dvdx), std::abs(rec.dvdy)) * height);
+	//magnified or no differentials, the common case, needs no log2
+	if (footprint <= 1) return bilinear(0);
+	Float level = std::log2(footprint);
+	int maxLevel = levelCount - 1;
+	if (level >= maxLevel) return bilinear(maxLevel);
+	int lower = static_cast<int>(level);
+	Float t = level - lower;
+	return (1 - t) * bilinear(lower) + t * bilinear(lower + 1);
+}
+
 class SolidColorTexture : public Texture {
 public:
 	SolidColorTexture() {}
@@ -32,7 +68,7 @@ public:
 	CheckerTexture(Color c1, Color c2)
 		: even(std::make_shared<SolidColorTexture>(c1)), odd(std::make_shared<SolidColorTexture>(c2)) {}
 
-	virtual Color Value(double u, double v, const Point3f& p) const override {
+	virtual Color Value(Float u, Float v, const Point3f& p) const override {
 		auto sines = sin(10 * p.x) * sin(10 * p.y) * sin(10 * p.z);
 		if (sines < 0)
 			return odd->Value(u, v, p);
@@ -40,6 +76,12 @@ public:
 			return even->Value(u, v, p);
 	}
 
+	virtual Color FilteredValue(const IntersectionRecord& rec) const override {
+		const auto& p = rec.hitPoint;
+		auto sines = sin(10 * p.x) * sin(10 * p.y) * sin(10 * p.z);
+		return sines < 0 ? odd->FilteredValue(rec) : even->FilteredValue(rec);
+	}
+
 public:
 	std::shared_ptr<Texture> odd;
 	std::shared_ptr<Texture> even;
@@ -47,22 +89,27 @@ public:
 
 class ImageTexture : public Texture {
 public:
-	const static int bytesPerPixel = 3;
-	ImageTexture():data(nullptr),width(0),height(0),bytesPerScanLine(0) {}
-	ImageTexture(const char* fileName){
-		auto componentsPerPixel = bytesPerPixel;
-		data = stbi_load(fileName, &width, &height, &componentsPerPixel, componentsPerPixel);
-		if (!data) {
+	//RGB padded to four bytes, so a texel never straddles a cache line
+	const static int bytesPerPixel = 4;
+	ImageTexture() {}
+	//The pixels are shared with every other texture of the same file through the cache.
+	ImageTexture(const char* fileName, std::shared_ptr<TextureCache> cache = nullptr) {
+		if (!cache) cache = TextureCache::Shared();
+		ImageDecodeOptions options;
+		options.components = bytesPerPixel;
+		options.mipmaps = true;
+		options.tiled = true;
+		image = cache->Acquire(fileName, options);
+		if (!image) {
 			std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
-			height = width = 0;
+			return;
 		}
-		bytesPerScanLine = bytesPerPixel * width;
+		width = image->width;
+		height = image->height;
 	}
 
-	~ImageTexture() { STBI_FREE(data); }
-
-	virtual Color Value(double u, double v, const Point3f& p) const override {
-		if (data == nullptr) return Color(0.92f, 0.33f, 0.9f);
+	virtual Color Value(Float u, Float v, const Point3f& p) const override {
+		if (!image) return Color(0.92f, 0.33f, 0.9f);
 
 		u = Clamp<Float>(u, 0.0, 1.0);
 		v = 1.0f - Clamp<Float>(v, 0.0, 1.0);
@@ -73,12 +120,68 @@ public:
 		if (j >= height) j = height - 1;
 
 		const auto colorScale = 1.0 / 256.0;
-		auto pixel = data + j * bytesPerScanLine + i * bytesPerPixel;
+		auto pixel = image->Texel(image->levels[0], i, j);
 		return Color(colorScale * pixel[0], colorScale * pixel[1], colorScale * pixel[2]);
 	}
+	virtual Color FilteredValue(const IntersectionRecord& rec) const override {
+		if (!image) return Color(0.92f, 0.33f, 0.9f);
+		return TrilinearLookup(rec, width, height, static_cast<int>(image->levels.size()), [&](int level) {
+			const auto& mip = image->levels[level];
+			return BilinearLookup(mip.width, mip.height, rec.u, rec.v, [&](int i0, int i1, int j0, int j1, Color c[4]) {
+				const uint8_t* texels[4];
+				image->Footprint(mip, i0, i1, j0, j1, texels);
+				for (int k = 0; k < 4; ++k) c[k] = Color(texels[k][0], texels[k][1], texels[k][2]);
+			});
+		});
+	}
+
+private:
+	std::shared_ptr<const ImageData> image;
+	int width = 0, height = 0;
+};
+
+//Image texture for scenes whose textures do not fit in memory: the image is read from its
+//tiled file (TiledImageFile) page by page as lookups reach it, and the pages live in a
+//fixed size TexturePageCache shared with every other paged texture.
+class PagedImageTexture : public Texture {
+public:
+	PagedImageTexture(const char* fileName, std::shared_ptr<TexturePageCache> cache = nullptr)
+		: cache(cache ? cache : TexturePageCache::Shared()) {
+		if (!file.Open(fileName))
+			std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
+	}
+
+	virtual Color Value(Float u, Float v, const Point3f& p) const override {
+		if (file.LevelCount() == 0) return Color(0.92f, 0.33f, 0.9f);
+
+		u = Clamp<Float>(u, 0.0, 1.0);
+		v = 1.0f - Clamp<Float>(v, 0.0, 1.0);
+		auto i = std::min(static_cast<int>(u * file.Width()), file.Width() - 1);
+		auto j = std::min(static_cast<int>(v * file.Height()), file.Height() - 1);
+		const auto colorScale = 1.0 / 256.0;
+		return colorScale * ToColor(cache->Texel(file, 0, i, j));
+	}
+
+	virtual Color FilteredValue(const IntersectionRecord& rec) const override {
+		if (file.LevelCount() == 0) return Color(0.92f, 0.33f, 0.9f);
+		return TrilinearLookup(rec, file.Width(), file.Height(), file.LevelCount(), [&](int level) {
+			const auto& mip = file.GetLevel(level);
+			return BilinearLookup(mip.width, mip.height, rec.u, rec.v, [&](int i0, int i1, int j0, int j1, Color c[4]) {
+				c[0] = ToColor(cache->Texel(file, level, i0, j0));
+				c[1] = ToColor(cache->Texel(file, level, i1, j0));
+				c[2] = ToColor(cache->Texel(file, level, i0, j1));
+				c[3] = ToColor(cache->Texel(file, level, i1, j1));
+			});
+		});
+	}
 
 private:
-	uint8_t *data;
-	int width, height;
-	int bytesPerScanLine;
+	static Color ToColor(uint32_t texel) {
+		uint8_t pixel[4];
+		memcpy(pixel, &texel, 4);
+		return Color(pixel[0], pixel[1], pixel[2]);
+	}
+
+	TiledImageFile file;
+	std::shared_ptr<TexturePageCache> cache;
 };
\ No newline at end of file
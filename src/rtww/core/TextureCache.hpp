@@ -0,0 +1,243 @@
+#pragma once
+
+#include "Core.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct ImageDecodeOptions {
+	int components = 3;
+	bool flipVertically = false;
+	bool mipmaps = false;
+	bool tiled = false;		//see ImageData::Tile
+};
+
+//Decoded 8 bit image, rows top to bottom unless decoded flipped. Read texels through
+//Texel, which knows the layout.
+struct ImageData {
+	static constexpr int TileShift = 3;		//8x8 texel tiles
+	static constexpr int TileMask = (1 << TileShift) - 1;
+
+	struct MipLevel {
+		const uint8_t* data;
+		int width, height;
+		int tilesPerRow;
+	};
+
+	ImageData(uint8_t* data, int width, int height, int components) : data(data), width(width), height(height), components(components) {
+		levels.push_back({ data, width, height, 0 });
+	}
+	ImageData(const ImageData&) = delete;
+	ImageData& operator=(const ImageData&) = delete;
+	~ImageData() { STBI_FREE(data); }
+
+	size_t Bytes() const { return (data ? size_t(width) * height * components : 0) + pyramid.size(); }
+
+	const uint8_t* Texel(const MipLevel& level, int i, int j) const { return level.data + TexelIndex(level, i, j) * components; }
+	size_t TexelIndex(const MipLevel& level, int i, int j) const { return RowIndex(level, j) + ColumnIndex(level, i); }
+	//The texels (i0, j0), (i1, j0), (i0, j1), (i1, j1) of a bilinear footprint. The index
+	//splits into a row and a column part, so the layout is checked once and each axis
+	//is addressed twice instead of every texel in full.
+	void Footprint(const MipLevel& level, int i0, int i1, int j0, int j1, const uint8_t* texels[4]) const {
+		size_t row0, row1, column0, column1;
+		if (tiled) {
+			row0 = TiledRowIndex(level, j0), row1 = TiledRowIndex(level, j1);
+			column0 = TiledColumnIndex(i0), column1 = TiledColumnIndex(i1);
+		}
+		else {
+			row0 = size_t(j0) * level.width, row1 = size_t(j1) * level.width;
+			column0 = i0, column1 = i1;
+		}
+		texels[0] = level.data + (row0 + column0) * components;
+		texels[1] = level.data + (row0 + column1) * components;
+		texels[2] = level.data + (row1 + column0) * components;
+		texels[3] = level.data + (row1 + column1) * components;
+	}
+
+	//Box filters the image down to 1x1, each level half the size of the one before.
+	void BuildMipLevels();
+	//Rearranges every level into 8x8 tiles stored one after another, texels row by row
+	//inside a tile, so a bilinear or mip footprint touches one or two tiles instead of
+	//rows a whole scanline apart. With 4 components a tile is four 64 byte cache lines.
+	void Tile();
+
+	size_t RowIndex(const MipLevel& level, int j) const { return tiled ? TiledRowIndex(level, j) : size_t(j) * level.width; }
+	size_t ColumnIndex(const MipLevel& level, int i) const { return tiled ? TiledColumnIndex(i) : size_t(i); }
+	//start of the tile row plus the texel row inside the tile, shifts and masks only
+	static size_t TiledRowIndex(const MipLevel& level, int j) {
+		return ((size_t(j >> TileShift) * level.tilesPerRow) << (2 * TileShift)) + ((j & TileMask) << TileShift);
+	}
+	static size_t TiledColumnIndex(int i) { return (size_t(i >> TileShift) << (2 * TileShift)) + (i & TileMask); }
+
+	uint8_t* data;		//nullptr once tiled
+	int width, height, components;
+	bool tiled = false;
+	std::vector<MipLevel> levels;	//levels[0] is data until tiled
+	std::vector<uint8_t> pyramid;	//storage of the levels after the first, of every level once tiled
+};
+
+void ImageData::BuildMipLevels() {
+	levels.resize(1);
+	size_t total = 0;
+	for (int w = width, h = height; w > 1 || h > 1;) {
+		w = std::max(1, w / 2);
+		h = std::max(1, h / 2);
+		total += size_t(w) * h * components;
+	}
+	pyramid.resize(total);
+
+	auto target = pyramid.data();
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		auto source = levels.back();
+		MipLevel level = { target, std::max(1, source.width / 2), std::max(1, source.height / 2), 0 };
+		//odd sizes drop their last row or column
+		auto texel = [&](int i, int j, int c) {
+			return int(source.data[(size_t(std::min(j, source.height - 1)) * source.width + std::min(i, source.width - 1)) * components + c]);
+		};
+		for (int j = 0; j < level.height; ++j)
+			for (int i = 0; i < level.width; ++i)
+				for (int c = 0; c < components; ++c)
+					*target++ = static_cast<uint8_t>((texel(2 * i, 2 * j, c) + texel(2 * i + 1, 2 * j, c)
+						+ texel(2 * i, 2 * j + 1, c) + texel(2 * i + 1, 2 * j + 1, c) + 2) / 4);
+		levels.push_back(level);
+	}
+}
+
+void ImageData::Tile() {
+	if (tiled) return;
+	auto tileCount = [](int texels) { return (texels + TileMask) >> TileShift; };
+	size_t total = 0;
+	for (const auto& level : levels)
+		total += size_t(tileCount(level.width)) * tileCount(level.height) << (2 * TileShift);
+	std::vector<uint8_t> tiles(total * components);
+
+	tiled = true;
+	size_t offset = 0;
+	for (auto& level : levels) {
+		MipLevel tiledLevel = { tiles.data() + offset, level.width, level.height, tileCount(level.width) };
+		for (int j = 0; j < level.height; ++j)
+			for (int i = 0; i < level.width; ++i)
+				memcpy(tiles.data() + offset + TexelIndex(tiledLevel, i, j) * components, level.data + (size_t(j) * level.width + i) * components, components);
+		offset += (size_t(tiledLevel.tilesPerRow) * tileCount(level.height) << (2 * TileShift)) * components;
+		level = tiledLevel;
+	}
+	pyramid.swap(tiles);
+	STBI_FREE(data);
+	data = nullptr;
+}
+
+//Process wide cache of decoded images keyed by path and decode options, so a file used by
+//several textures, materials or frames is decoded and stored once. Images still in use
+//are never evicted; with a byte budget the least recently used images nobody holds any
+//more are dropped until the cache fits.
+class TextureCache {
+public:
+	struct Stats {
+		size_t images = 0;
+		size_t bytes = 0;			//all images the cache holds
+		size_t pinnedBytes = 0;		//images in use outside the cache
+		uint64_t hits = 0, misses = 0, evictions = 0;
+	};
+
+	static std::shared_ptr<TextureCache> Shared() {
+		static auto shared = std::make_shared<TextureCache>();
+		return shared;
+	}
+
+	//nullptr when the file can not be decoded
+	std::shared_ptr<const ImageData> Acquire(const std::string& filePath, const ImageDecodeOptions& options = ImageDecodeOptions());
+
+	//0: unlimited
+	void SetBudget(size_t bytes);
+	Stats GetStats() const;
+
+private:
+	struct Entry {
+		std::shared_ptr<const ImageData> image;
+		std::list<std::string>::iterator recent;
+	};
+
+	void Trim();
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries;
+	std::list<std::string> recentlyUsed;	//front: most recent
+	size_t bytes = 0;
+	size_t budget = 0;
+	uint64_t hits = 0, misses = 0, evictions = 0;
+};
+
+std::shared_ptr<const ImageData> TextureCache::Acquire(const std::string& filePath, const ImageDecodeOptions& options) {
+	auto key = filePath + '|' + std::to_string(options.components) + (options.flipVertically ? "|flip" : "")
+		+ (options.mipmaps ? "|mip" : "") + (options.tiled ? "|tiled" : "");
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = entries.find(key);
+		if (found != entries.end()) {
+			++hits;
+			recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, found->second.recent);
+			return found->second.image;
+		}
+	}
+
+	//decode outside the lock, a concurrent load of the same file keeps the first result
+	int width, height, fileComponents;
+	auto data = stbi_load(filePath.c_str(), &width, &height, &fileComponents, options.components);
+	if (!data) return nullptr;
+	if (options.flipVertically) {
+		size_t rowBytes = size_t(width) * options.components;
+		for (int top = 0, bottom = height - 1; top < bottom; ++top, --bottom)
+			std::swap_ranges(data + top * rowBytes, data + (top + 1) * rowBytes, data + bottom * rowBytes);
+	}
+	auto decoded = std::make_shared<ImageData>(data, width, height, options.components);
+	if (options.mipmaps) decoded->BuildMipLevels();
+	if (options.tiled) decoded->Tile();
+	std::shared_ptr<const ImageData> image = decoded;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	++misses;
+	auto found = entries.find(key);
+	if (found != entries.end()) return found->second.image;
+	recentlyUsed.push_front(key);
+	entries[key] = { image, recentlyUsed.begin() };
+	bytes += image->Bytes();
+	Trim();
+	return image;
+}
+
+void TextureCache::SetBudget(size_t budgetBytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = budgetBytes;
+	Trim();
+}
+
+void TextureCache::Trim() {
+	if (budget == 0) return;
+	for (auto it = recentlyUsed.end(); bytes > budget && it != recentlyUsed.begin();) {
+		--it;
+		auto entry = entries.find(*it);
+		//the cache's own reference is the only one left
+		if (entry->second.image.use_count() > 1) continue;
+		bytes -= entry->second.image->Bytes();
+		entries.erase(entry);
+		it = recentlyUsed.erase(it);
+		++evictions;
+	}
+}
+
+TextureCache::Stats TextureCache::GetStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	Stats stats;
+	stats.images = entries.size();
+	stats.bytes = bytes;
+	for (const auto& entry : entries)
+		if (entry.second.image.use_count() > 1) stats.pinnedBytes += entry.second.image->Bytes();
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	return stats;
+}
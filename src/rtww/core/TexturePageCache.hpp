@@ -0,0 +1,328 @@
+#pragma once
+
+#include "Core.hpp"
+#include "core/File.hpp"
+#include "TextureCache.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+//Mip pyramid of an image in 32x32 texel RGBA pages, each page made of 8x8 texel tiles like
+//ImageData::Tile. Written next to the source as <image>.rtwwtex the first time the image is
+//used and memory mapped afterwards, so a render only reads the pages it touches, through a
+//TexturePageCache. The file is valid while the source keeps its size and modification time;
+//unlike the mesh cache the source is not hashed, which would read gigabytes of images on
+//every start.
+class TiledImageFile {
+public:
+	static constexpr uint32_t Version = 1;
+	static constexpr int PageShift = 5;
+	static constexpr int PageMask = (1 << PageShift) - 1;
+	static constexpr int PageTexels = 1 << (2 * PageShift);
+	static constexpr size_t PageBytes = PageTexels * sizeof(uint32_t);
+
+	struct Level {
+		int32_t width, height;
+		int32_t pagesPerRow, reserved;
+		uint64_t firstPage;
+	};
+
+	TiledImageFile() : id(nextId++) {}
+	TiledImageFile(const TiledImageFile&) = delete;
+	TiledImageFile& operator=(const TiledImageFile&) = delete;
+
+	//Maps the tiled file of sourcePath, writing it first when missing or stale.
+	bool Open(const std::string& sourcePath);
+
+	uint32_t Id() const { return id; }
+	int Width() const { return levels.empty() ? 0 : levels[0].width; }
+	int Height() const { return levels.empty() ? 0 : levels[0].height; }
+	int LevelCount() const { return static_cast<int>(levels.size()); }
+	const Level& GetLevel(int level) const { return levels[level]; }
+
+	uint64_t PageOf(int level, int i, int j) const {
+		const auto& l = levels[level];
+		return l.firstPage + uint64_t(j >> PageShift) * l.pagesPerRow + (i >> PageShift);
+	}
+	static int TexelInPage(int i, int j) {
+		const int tileShift = ImageData::TileShift, tileMask = ImageData::TileMask;
+		int tile = ((j & PageMask) >> tileShift << (PageShift - tileShift)) + ((i & PageMask) >> tileShift);
+		return (tile << (2 * tileShift)) + ((j & tileMask) << tileShift) + (i & tileMask);
+	}
+	const uint8_t* PageData(uint64_t page) const { return file.Data() + dataOffset + page * PageBytes; }
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t levelCount;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t pageCount;
+		uint64_t dataOffset;	//page aligned, the levels follow the header
+	};
+
+	static bool Write(const std::string& filePath, const std::string& sourcePath, uint64_t sourceSize, int64_t sourceTime);
+	bool Validate(uint64_t sourceSize, int64_t sourceTime);
+
+	static constexpr char Magic[8] = { 'R', 'T', 'W', 'W', 'T', 'E', 'X', '\0' };
+	static std::atomic<uint32_t> nextId;
+
+	MappedFile file;
+	std::vector<Level> levels;
+	uint64_t dataOffset = 0;
+	uint32_t id;
+};
+
+constexpr char TiledImageFile::Magic[8];
+std::atomic<uint32_t> TiledImageFile::nextId(0);
+
+bool TiledImageFile::Open(const std::string& sourcePath) {
+	std::error_code error;
+	auto sourceSize = fs::file_size(sourcePath, error);
+	if (error) {
+		std::cerr << "Fail to open " << sourcePath << '\n';
+		return false;
+	}
+	int64_t sourceTime = fs::last_write_time(sourcePath, error).time_since_epoch().count();
+
+	auto filePath = sourcePath + ".rtwwtex";
+	if (file.Open(filePath.c_str()) && Validate(sourceSize, sourceTime)) return true;
+	file.Close();
+	if (!Write(filePath, sourcePath, sourceSize, sourceTime)) return false;
+	return file.Open(filePath.c_str()) && Validate(sourceSize, sourceTime);
+}
+
+bool TiledImageFile::Validate(uint64_t sourceSize, int64_t sourceTime) {
+	levels.clear();
+	Header header;
+	if (file.Size() < sizeof(Header)) return false;
+	memcpy(&header, file.Data(), sizeof(Header));
+	if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version
+		|| header.sourceSize != sourceSize || header.sourceTime != sourceTime || header.levelCount == 0)
+		return false;
+	if (sizeof(Header) + uint64_t(header.levelCount) * sizeof(Level) > header.dataOffset
+		|| header.dataOffset > file.Size() || header.pageCount > (file.Size() - header.dataOffset) / PageBytes)
+		return false;
+
+	levels.resize(header.levelCount);
+	memcpy(levels.data(), file.Data() + sizeof(Header), levels.size() * sizeof(Level));
+	for (const auto& level : levels) {
+		uint64_t pages = uint64_t((level.height + PageMask) >> PageShift) * level.pagesPerRow;
+		if (level.width <= 0 || level.height <= 0 || level.pagesPerRow != (level.width + PageMask) >> PageShift
+			|| level.firstPage > header.pageCount || pages > header.pageCount - level.firstPage) {
+			levels.clear();
+			return false;
+		}
+	}
+	dataOffset = header.dataOffset;
+	return true;
+}
+
+bool TiledImageFile::Write(const std::string& filePath, const std::string& sourcePath, uint64_t sourceSize, int64_t sourceTime) {
+	//the whole image is decoded once here, renders only ever read pages of the result
+	int width, height, fileComponents;
+	auto data = stbi_load(sourcePath.c_str(), &width, &height, &fileComponents, 4);
+	if (!data) {
+		std::cerr << "ERROR: Could not load texture image file '" << sourcePath << "'.\n";
+		return false;
+	}
+	ImageData image(data, width, height, 4);
+	image.BuildMipLevels();
+
+	Header header = {};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.levelCount = static_cast<uint32_t>(image.levels.size());
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	std::vector<Level> entries;
+	for (const auto& mip : image.levels) {
+		Level level = { mip.width, mip.height, (mip.width + PageMask) >> PageShift, 0, header.pageCount };
+		header.pageCount += uint64_t((mip.height + PageMask) >> PageShift) * level.pagesPerRow;
+		entries.push_back(level);
+	}
+	header.dataOffset = (sizeof(Header) + entries.size() * sizeof(Level) + PageBytes - 1) / PageBytes * PageBytes;
+
+	//written under a temporary name and renamed, like the mesh cache
+	std::string tempPath = filePath + ".tmp";
+	std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cerr << "Fail to open " << tempPath << '\n' << std::flush;
+		return false;
+	}
+	std::vector<char> padding(header.dataOffset - sizeof(Header) - entries.size() * sizeof(Level), 0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+	out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Level));
+	out.write(padding.data(), padding.size());
+
+	std::vector<uint8_t> page(PageBytes);
+	for (size_t l = 0; l < entries.size(); ++l) {
+		const auto& mip = image.levels[l];
+		for (int pageY = 0; pageY < mip.height; pageY += 1 << PageShift)
+			for (int pageX = 0; pageX < mip.width; pageX += 1 << PageShift) {
+				//texels past the edge of the level repeat the edge
+				for (int j = pageY; j < pageY + (1 << PageShift); ++j)
+					for (int i = pageX; i < pageX + (1 << PageShift); ++i)
+						memcpy(&page[TexelInPage(i, j) * 4], image.Texel(mip, std::min(i, mip.width - 1), std::min(j, mip.height - 1)), 4);
+				out.write(reinterpret_cast<const char*>(page.data()), page.size());
+			}
+	}
+	out.close();
+	if (!out) {
+		std::cerr << "Fail to write the tiled texture " << tempPath << '\n' << std::flush;
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	std::remove(filePath.c_str());
+	if (std::rename(tempPath.c_str(), filePath.c_str()) != 0) {
+		std::cerr << "Fail to rename " << tempPath << " to " << filePath << '\n' << std::flush;
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+//Fixed size, set associative cache of texture pages shared by the paged textures of the
+//process, so memory stays bounded however many gigabytes the scene references. Lookups
+//from worker threads take no lock: each slot is a seqlock, a reader copies the texel and
+//keeps it only if the slot's sequence did not change meanwhile. A miss takes the lock of
+//its set, copies the page out of the mapped file and replaces a slot of the set by second
+//chance (clock). The texel pool is allocated up front but only committed as pages load:
+//it is plain uint32_t storage read and written through atomic views, an array of
+//std::atomic would be value initialized, so zeroed and committed, since C++20.
+class TexturePageCache {
+public:
+	static constexpr size_t DefaultBytes = size_t(256) << 20;
+	static constexpr int Ways = 8;
+
+	struct Stats {
+		size_t pages = 0;
+		size_t bytes = 0;	//of the resident pages, the pool is capacity
+		size_t capacity = 0;
+		uint64_t loads = 0, evictions = 0;
+	};
+
+	explicit TexturePageCache(size_t bytes = DefaultBytes);
+
+	static std::shared_ptr<TexturePageCache> Shared() {
+		static auto shared = std::make_shared<TexturePageCache>();
+		return shared;
+	}
+
+	//RGBA texel (i, j) of a level, i and j inside the level.
+	uint32_t Texel(const TiledImageFile& image, int level, int i, int j) {
+		auto page = image.PageOf(level, i, j);
+		auto key = (uint64_t(image.Id()) << 40) | page;
+		auto set = SetOf(key);
+		auto texel = TiledImageFile::TexelInPage(i, j);
+		for (size_t slot = set * Ways; slot < (set + 1) * Ways; ++slot) {
+			auto& s = slots[slot];
+			auto before = s.sequence.load(std::memory_order_acquire);
+			if ((before & 1) || s.key.load(std::memory_order_relaxed) != key) continue;
+			auto value = LoadTexel(slot * TiledImageFile::PageTexels + texel);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (s.sequence.load(std::memory_order_relaxed) != before) break;
+			//only written when clear, so hot slots are not dirtied on every lookup
+			if (!s.referenced.load(std::memory_order_relaxed)) s.referenced.store(1, std::memory_order_relaxed);
+			return value;
+		}
+		return Load(image, key, page, set, texel);
+	}
+
+	Stats GetStats() const;
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> sequence{ 0 };	//odd while the page is replaced
+		std::atomic<uint64_t> key{ Empty };
+		std::atomic<uint8_t> referenced{ 0 };
+	};
+
+	static constexpr uint64_t Empty = ~uint64_t(0);
+	static constexpr size_t LockCount = 64;
+
+	size_t SetOf(uint64_t key) const {
+		key ^= key >> 31;
+		key *= 0x9e3779b97f4a7c15ull;
+		return static_cast<size_t>(key >> 32) & setMask;
+	}
+
+	uint32_t Load(const TiledImageFile& image, uint64_t key, uint64_t page, size_t set, int texel);
+
+#if defined(__cpp_lib_atomic_ref)
+	uint32_t LoadTexel(size_t index) const { return std::atomic_ref<uint32_t>(texels[index]).load(std::memory_order_relaxed); }
+	void StoreTexel(size_t index, uint32_t value) { std::atomic_ref<uint32_t>(texels[index]).store(value, std::memory_order_relaxed); }
+#else
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && alignof(std::atomic<uint32_t>) == alignof(uint32_t), "texel pool needs a plain atomic layout");
+	uint32_t LoadTexel(size_t index) const { return reinterpret_cast<const std::atomic<uint32_t>&>(texels[index]).load(std::memory_order_relaxed); }
+	void StoreTexel(size_t index, uint32_t value) { reinterpret_cast<std::atomic<uint32_t>&>(texels[index]).store(value, std::memory_order_relaxed); }
+#endif
+
+	size_t setMask;
+	std::unique_ptr<Slot[]> slots;
+	std::unique_ptr<uint32_t[]> texels;
+	std::unique_ptr<std::mutex[]> locks;
+	std::vector<uint8_t> hands;		//clock hand of each set, guarded by the set's lock
+	std::atomic<size_t> resident{ 0 };
+	std::atomic<uint64_t> loads{ 0 }, evictions{ 0 };
+};
+
+TexturePageCache::TexturePageCache(size_t bytes) {
+	size_t sets = 1;
+	while (sets * 2 * Ways * TiledImageFile::PageBytes <= bytes) sets *= 2;
+	setMask = sets - 1;
+	slots.reset(new Slot[sets * Ways]);
+	//default initialized, left untouched until a page is loaded into its slot
+	texels.reset(new uint32_t[sets * Ways * TiledImageFile::PageTexels]);
+	locks.reset(new std::mutex[LockCount]);
+	hands.assign(sets, 0);
+}
+
+uint32_t TexturePageCache::Load(const TiledImageFile& image, uint64_t key, uint64_t page, size_t set, int texel) {
+	std::lock_guard<std::mutex> lock(locks[set % LockCount]);
+	auto first = set * Ways;
+	//another thread may have loaded the page while this one waited
+	for (size_t slot = first; slot < first + Ways; ++slot)
+		if (slots[slot].key.load(std::memory_order_relaxed) == key)
+			return LoadTexel(slot * TiledImageFile::PageTexels + texel);
+
+	size_t victim = first + hands[set];
+	for (;; victim = first + (victim - first + 1) % Ways) {
+		auto& s = slots[victim];
+		if (s.key.load(std::memory_order_relaxed) == Empty || !s.referenced.exchange(0, std::memory_order_relaxed)) break;
+	}
+	hands[set] = static_cast<uint8_t>((victim - first + 1) % Ways);
+
+	auto& s = slots[victim];
+	if (s.key.load(std::memory_order_relaxed) == Empty) resident.fetch_add(1, std::memory_order_relaxed);
+	else evictions.fetch_add(1, std::memory_order_relaxed);
+	loads.fetch_add(1, std::memory_order_relaxed);
+
+	auto sequence = s.sequence.load(std::memory_order_relaxed);
+	s.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	s.key.store(key, std::memory_order_relaxed);
+	auto source = image.PageData(page);
+	auto target = victim * TiledImageFile::PageTexels;
+	for (int t = 0; t < TiledImageFile::PageTexels; ++t) {
+		uint32_t value;
+		memcpy(&value, source + t * sizeof(uint32_t), sizeof(uint32_t));
+		StoreTexel(target + t, value);
+	}
+	s.referenced.store(1, std::memory_order_relaxed);
+	s.sequence.store(sequence + 2, std::memory_order_release);
+	return LoadTexel(target + texel);
+}
+
+TexturePageCache::Stats TexturePageCache::GetStats() const {
+	Stats stats;
+	stats.pages = resident.load();
+	stats.bytes = stats.pages * TiledImageFile::PageBytes;
+	stats.capacity = (setMask + 1) * Ways * TiledImageFile::PageBytes;
+	stats.loads = loads.load();
+	stats.evictions = evictions.load();
+	return stats;
+}
@@ -1,5 +1,36 @@
 #pragma once
 #include "Core.hpp"
+
+//Most scene transforms have no rotation and no or uniform scale, such transforms skip
+//the matrix entirely.
+enum class TransformKind : uint8_t {
+	Translation,	//x + offset
+	UniformScale,	//scale * x + offset, scale > 0
+	Affine			//full 3x4 matrix
+};
+
+//One direction of a Transform: the affine matrix plus the scale and offset used by the
+//cheaper kinds.
+struct AffineMap {
+	template <TransformKind Kind>
+	inline Point3f Apply(const Point3f& p) const {
+		if constexpr (Kind == TransformKind::Translation) return p + offset;
+		else if constexpr (Kind == TransformKind::UniformScale) return p * scale + offset;
+		else return matrix(p);
+	}
+
+	template <TransformKind Kind>
+	inline Vector3f Apply(const Vector3f& v) const {
+		if constexpr (Kind == TransformKind::Translation) return v;
+		else if constexpr (Kind == TransformKind::UniformScale) return v * scale;
+		else return matrix(v);
+	}
+
+	AffineMatrix matrix;
+	Float scale = 1;
+	Vector3f offset;
+};
+
 class Transform {
 public:
 	Transform() {}
@@ -11,12 +42,22 @@ public:
 	Transform(const Matrix4x4& o2w) : object2World(o2w), world2Object(o2w.Inverse()) {}
 	Transform(const Matrix4x4& o2w, const Matrix4x4& w2o) : object2World(o2w), world2Object(w2o) {}*/
 	Transform(const Point3f& position, const Vector3f& scale, const Vector3f& rotation) :scale(scale), position(position), rotation(rotation) {
-		object2World = Translate(Convert(position)) * CreateQuaternionByVec3(rotation).ToMatrix4x4() * Scale(scale);
-		world2Object = object2World.Inverse();
+		auto object2World = Translate(Convert(position)) * CreateQuaternionByVec3(rotation).ToMatrix4x4() * Scale(scale);
+		Classify(object2World, object2World.Inverse());
 	}
 
-	const Matrix4x4&  GetObject2WorldMatrix() const { return object2World; }
-	const Matrix4x4&  GetWorld2ObjectMatrix() const { return world2Object; }
+	const AffineMatrix& GetObject2WorldMatrix() const { return toWorld.matrix; }
+	const AffineMatrix& GetWorld2ObjectMatrix() const { return toObject.matrix; }
+	TransformKind GetKind() const { return kind; }
+
+	//Shapes transform every ray and hit point through these, they dispatch on the kind once
+	//and run the specialized arithmetic.
+	template <typename T> inline T ToWorld(const T& x) const { return Apply(toWorld, x); }
+	template <typename T> inline T ToObject(const T& x) const { return Apply(toObject, x); }
+	inline Ray ToWorld(const Ray& r) const { return Ray(ToWorld(r.origin), ToWorld(r.direction), r.time); }
+	inline Ray ToObject(const Ray& r) const { return Ray(ToObject(r.origin), ToObject(r.direction), r.time); }
+	//Object space normal to world space with the inverse transpose, not normalized.
+	inline Vector3f NormalToWorld(const Vector3f& n) const { return kind == TransformKind::Affine ? normalMatrix(n) : n; }
 	const Point3f&    GetPosition()			  const { return position;	   }
 	const Vector3f&   GetScale()			  const { return scale;		   }
 	const Vector3f& GetRotation()			  const { return rotation;	   }
@@ -24,13 +65,49 @@ public:
 	/*Transform Inverse() const { return Transform(world2Object, object2World); }
 	Transform Transpose() const { return Transform(object2World.Transpose(), world2Object.Transpose()); }*/
 
-	bool operator==(const Transform& t) const { return object2World == t.object2World && world2Object == t.world2Object; }
-	bool operator!=(const Transform& t) const { return object2World != t.object2World || world2Object != t.world2Object; }
+	//the inverse follows from the forward matrix, comparing that one is enough
+	bool operator==(const Transform& t) const { return toWorld.matrix.ToMatrix4x4() == t.toWorld.matrix.ToMatrix4x4(); }
+	bool operator!=(const Transform& t) const { return !(*this == t); }
+
+private:
+	//Only the affine maps are kept, the 4x4 matrices are dropped once classified.
+	void Classify(const Matrix4x4& object2World, const Matrix4x4& world2Object);
+
+	template <typename T>
+	inline T Apply(const AffineMap& map, const T& x) const {
+		switch (kind) {
+		case TransformKind::Translation: return map.Apply<TransformKind::Translation>(x);
+		case TransformKind::UniformScale: return map.Apply<TransformKind::UniformScale>(x);
+		default: return map.Apply<TransformKind::Affine>(x);
+		}
+	}
 
 private:
-	Matrix4x4 object2World, world2Object;
+	AffineMap toWorld, toObject;
+	AffineMatrix normalMatrix;
+	TransformKind kind = TransformKind::Affine;
 	Vector3f scale;
 	Point3f position;
 	Vector3f rotation;
 	friend class Quaternion;
-};
\ No newline at end of file
+};
+
+void Transform::Classify(const Matrix4x4& object2World, const Matrix4x4& world2Object) {
+	toWorld.matrix = AffineMatrix(object2World);
+	toObject.matrix = AffineMatrix(world2Object);
+	//the translation column of the transpose is the bottom row of world2Object, zero
+	normalMatrix = AffineMatrix(world2Object.Transpose());
+
+	const auto& m = object2World.data;
+	bool diagonal = m[0][1] == 0 && m[0][2] == 0 && m[1][0] == 0 && m[1][2] == 0 && m[2][0] == 0 && m[2][1] == 0;
+	Float s = m[0][0];
+	if (!diagonal || m[1][1] != s || m[2][2] != s || s <= 0) {
+		kind = TransformKind::Affine;
+		return;
+	}
+	kind = s == 1 ? TransformKind::Translation : TransformKind::UniformScale;
+	toWorld.scale = s;
+	toWorld.offset = Vector3f(m[0][3], m[1][3], m[2][3]);
+	toObject.scale = 1 / s;
+	toObject.offset = -toWorld.offset / s;
+}
\ No newline at end of file
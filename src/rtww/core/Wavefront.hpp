@@ -0,0 +1,537 @@
+#pragma once
+
+#include "core/Frame.hpp"
+#include "core/Material.hpp"
+#include "core/Sampler.hpp"
+#include <algorithm>
+#include <chrono>
+
+//Spreads the low 10 bits of x so that two zero bits follow each of them.
+inline uint32_t LeftShift3(uint32_t x) {
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+inline uint32_t EncodeMorton3(uint32_t x, uint32_t y, uint32_t z) {
+	return (LeftShift3(z) << 2) | (LeftShift3(y) << 1) | LeftShift3(x);
+}
+
+//Ray geometry stored as one array per component (SoA), so the stage loops stream
+//through memory instead of hopping between whole path records.
+struct RayQueue {
+	std::vector<Float> ox, oy, oz;
+	std::vector<Float> dx, dy, dz;
+	std::vector<Float> time;
+	std::vector<uint32_t> path;	//slot of the owning path in the PathQueue
+
+	size_t Size() const { return path.size(); }
+	bool Empty() const { return path.empty(); }
+
+	void Clear() {
+		ox.clear(); oy.clear(); oz.clear();
+		dx.clear(); dy.clear(); dz.clear();
+		time.clear();
+		path.clear();
+	}
+
+	void Reserve(size_t n) {
+		ox.reserve(n); oy.reserve(n); oz.reserve(n);
+		dx.reserve(n); dy.reserve(n); dz.reserve(n);
+		time.reserve(n);
+		path.reserve(n);
+	}
+
+	inline void Push(const Ray& r, uint32_t pathIndex) {
+		ox.push_back(r.origin.x); oy.push_back(r.origin.y); oz.push_back(r.origin.z);
+		dx.push_back(r.direction.x); dy.push_back(r.direction.y); dz.push_back(r.direction.z);
+		time.push_back(r.time);
+		path.push_back(pathIndex);
+	}
+
+	inline Ray Get(size_t i) const {
+		return Ray(Point3f(ox[i], oy[i], oz[i]), Vector3f(dx[i], dy[i], dz[i]), time[i]);
+	}
+};
+
+//State that survives between the bounces of a path, SoA like RayQueue.
+struct PathQueue {
+	std::vector<Float> throughputR, throughputG, throughputB;
+	std::vector<Float> radianceR, radianceG, radianceB;
+	std::vector<Float> bsdfPdf;				//pdf of the BSDF sample that produced the current ray
+	std::vector<Float> lastX, lastY, lastZ;	//where that sample started, for the MIS weight of the emitter it hits
+	std::vector<int> pixel;					//x within the line
+	std::vector<uint32_t> sampleIndex;
+	std::vector<uint32_t> dimension;		//next sampler dimension, the path resumes there at its next stage
+	std::vector<uint8_t> specularBounce;
+
+	void Resize(size_t n) {
+		throughputR.resize(n); throughputG.resize(n); throughputB.resize(n);
+		radianceR.resize(n); radianceG.resize(n); radianceB.resize(n);
+		bsdfPdf.resize(n);
+		lastX.resize(n); lastY.resize(n); lastZ.resize(n);
+		pixel.resize(n);
+		sampleIndex.resize(n);
+		dimension.resize(n);
+		specularBounce.resize(n);
+	}
+
+	inline Color Throughput(size_t i) const { return Color(throughputR[i], throughputG[i], throughputB[i]); }
+	inline void SetThroughput(size_t i, const Color& c) {
+		throughputR[i] = c.x;
+		throughputG[i] = c.y;
+		throughputB[i] = c.z;
+	}
+
+	inline Color Radiance(size_t i) const { return Color(radianceR[i], radianceG[i], radianceB[i]); }
+	inline void AddRadiance(size_t i, const Color& c) {
+		radianceR[i] += c.x;
+		radianceG[i] += c.y;
+		radianceB[i] += c.z;
+	}
+
+	inline Point3f LastHit(size_t i) const { return Point3f(lastX[i], lastY[i], lastZ[i]); }
+	inline void SetLastHit(size_t i, const Point3f& p) {
+		lastX[i] = p.x;
+		lastY[i] = p.y;
+		lastZ[i] = p.z;
+	}
+};
+
+//Shadow rays towards sampled lights with their contribution up to the emitted
+//radiance, which is only known once the ray found the emitter.
+struct ShadowQueue {
+	RayQueue rays;
+	std::vector<Float> r, g, b;
+
+	size_t Size() const { return rays.Size(); }
+	void Clear() {
+		rays.Clear();
+		r.clear(); g.clear(); b.clear();
+	}
+
+	inline void Push(const Ray& ray, uint32_t pathIndex, const Color& contribution) {
+		rays.Push(ray, pathIndex);
+		r.push_back(contribution.x);
+		g.push_back(contribution.y);
+		b.push_back(contribution.z);
+	}
+
+	inline Color Contribution(size_t i) const { return Color(r[i], g[i], b[i]); }
+};
+
+//Breadth-first alternative to the depth-first RayColor. A wave of up to maxPaths
+//paths advances one bounce at a time through batched stages:
+//  extend  - closest hit for every queued ray, misses pick up the background
+//  shade   - emission, scattering, light sampling and Russian roulette per hit
+//  shadow  - every light sample of the bounce, traced in one loop
+//and is accumulated into the line once all of its paths ended. Camera and shadow rays
+//go through the scene in packets of packetSize rays (see RayPacket), later bounces are
+//too incoherent for that and are traced one ray at a time; with sortSecondaryRays they
+//are at least reordered so consecutive rays start close together and head the same way. The estimator and the
+//order in which sampler dimensions are consumed match RayColor, so both engines
+//converge to the same image.
+class WavefrontIntegrator {
+public:
+	//packetSize 4, 8 or 16 (at most RayPacket::MaxSize), 1 disables packet traversal
+	WavefrontIntegrator(uint32_t maxPaths = 1 << 14, uint32_t packetSize = 8)
+		: maxPaths(maxPaths), packetSize(std::min<uint32_t>(packetSize, RayPacket::MaxSize)) {}
+
+	//Adds samples more paths to every pixel of line, the same contract as Draw.
+	void RenderLine(int line, uint32_t samples, const FrameSettings& settings, PathStats& stats);
+
+private:
+	void GenerateCameraRays(uint64_t first, uint32_t count, const FrameSettings& settings, PathStats& stats);
+	//Closest hit of every ray in queue, handed to onHit(k, rec) or onMiss(k). Packets whose
+	//rays do not share direction signs fall back to single rays.
+	template <typename HitFunction, typename MissFunction>
+	void Trace(const RayQueue& queue, bool usePackets, const FrameSettings& settings, HitFunction onHit, MissFunction onMiss);
+	void Extend(uint32_t bounce, const FrameSettings& settings, PathStats& stats);
+	void Shade(uint32_t bounce, const FrameSettings& settings, PathStats& stats);
+
+	struct ShadeContext {
+		const FrameSettings& settings;
+		PathStats& stats;
+		bool hasLights;
+		bool roulette;	//Russian roulette applies at this bounce
+	};
+	void ResumePath(uint32_t p);
+	void AddEmission(uint32_t p, const Ray& r, const Color& emitted, const ShadeContext& context);
+	void ContinuePath(uint32_t p, Color throughput, const Ray& next, ShadeContext& context);
+	bool SampleLight(const IntersectionRecord& rec, const Ray& r, Ray& shadow, Float& lightPdf, const ShadeContext& context);
+	void ShadeDiffuseLights(uint32_t first, uint32_t last, ShadeContext& context);
+	void ShadeLambertians(uint32_t first, uint32_t last, ShadeContext& context);
+	template <typename SpecularMaterial>
+	void ShadeSpecular(uint32_t first, uint32_t last, ShadeContext& context);
+	void ShadeGeneric(uint32_t first, uint32_t last, ShadeContext& context);
+	void TraceShadowRays(const FrameSettings& settings);
+	void SortRays(RayQueue& queue);
+
+public:
+	uint32_t maxPaths;
+	uint32_t packetSize;
+	bool sortSecondaryRays = true;
+
+private:
+	int line = 0;
+	RayPacket packet;
+	PacketHits packetHits;
+	std::shared_ptr<Sampler> sampler;
+	PathQueue paths;
+	RayQueue rays, nextRays, sortedRays;
+	ShadowQueue shadows;
+	bool hasSceneBounds = false;
+	AABB sceneBounds;
+	std::vector<uint64_t> sortKeys;
+	std::vector<IntersectionRecord> hits;
+	std::vector<uint32_t> hitRays;	//index into rays of each hit
+	std::vector<uint32_t> shadeOrder;	//hit indices grouped by material type
+	size_t hitCount = 0;
+	std::vector<uint32_t> startSamples;
+	std::vector<Color> lineSum;
+};
+
+void WavefrontIntegrator::RenderLine(int lineIndex, uint32_t samples, const FrameSettings& settings, PathStats& stats) {
+	auto& fb = *settings.framebuffer;
+	int width = settings.imageWidth;
+	line = lineIndex;
+	sampler = CreateSampler(settings.samplerType, settings.samplesPerPixel, settings.samplerSeed);
+	startSamples.resize(width);
+	for (int i = 0; i < width; ++i) startSamples[i] = fb.SampleCount(i, line);
+	lineSum.assign(width, Color(0, 0, 0));
+	hasSceneBounds = settings.objects->BoundingBox(0, 0, sceneBounds);
+
+	uint64_t total = uint64_t(width) * samples;
+	for (uint64_t first = 0; first < total; first += maxPaths) {
+		auto count = static_cast<uint32_t>(std::min<uint64_t>(maxPaths, total - first));
+		GenerateCameraRays(first, count, settings, stats);
+		for (uint32_t bounce = 0; bounce < settings.rayTracingDepth && !rays.Empty(); ++bounce) {
+			Extend(bounce, settings, stats);
+			Shade(bounce, settings, stats);
+			TraceShadowRays(settings);
+			if (sortSecondaryRays && hasSceneBounds && nextRays.Size() > 1) {
+				auto start = std::chrono::steady_clock::now();
+				SortRays(nextRays);
+				stats.sortNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			}
+			std::swap(rays, nextRays);
+		}
+		for (uint32_t p = 0; p < count; ++p)
+			lineSum[paths.pixel[p]] += paths.Radiance(p);
+	}
+
+	for (int i = 0; i < width; ++i)
+		fb.AddSamples(i, line, lineSum[i], samples);
+}
+
+//Paths are numbered sample major, so a wave covers whole lines of neighbouring pixels.
+void WavefrontIntegrator::GenerateCameraRays(uint64_t first, uint32_t count, const FrameSettings& settings, PathStats& stats) {
+	int width = settings.imageWidth;
+	paths.Resize(count);
+	rays.Clear();
+	rays.Reserve(count);
+	for (uint32_t p = 0; p < count; ++p) {
+		int i = static_cast<int>((first + p) % width);
+		auto index = startSamples[i] + static_cast<uint32_t>((first + p) / width);
+		sampler->StartPixelSample(Point2i(i, line), index);
+		auto jitter = sampler->Get2D();
+		auto u = Float(i + jitter.x) / (settings.imageWidth - 1);
+		auto v = Float(line + jitter.y) / (settings.imageHeight - 1);
+		Ray r = settings.camera->GenerateRay(u, v, sampler->Get2D());
+
+		paths.SetThroughput(p, Color(1, 1, 1));
+		paths.radianceR[p] = paths.radianceG[p] = paths.radianceB[p] = 0;
+		paths.bsdfPdf[p] = 0;
+		paths.pixel[p] = i;
+		paths.sampleIndex[p] = index;
+		paths.dimension[p] = sampler->Dimension();
+		paths.specularBounce[p] = 1;
+		rays.Push(r, p);
+	}
+	stats.paths += count;
+}
+
+template <typename HitFunction, typename MissFunction>
+void WavefrontIntegrator::Trace(const RayQueue& queue, bool usePackets, const FrameSettings& settings, HitFunction onHit, MissFunction onMiss) {
+	size_t step = usePackets && packetSize > 1 ? packetSize : 1;
+	for (size_t k = 0; k < queue.Size(); k += step) {
+		auto count = std::min(step, queue.Size() - k);
+		if (count > 1) {
+			packet.Clear();
+			for (size_t i = 0; i < count; ++i) packet.Add(queue.Get(k + i));
+			packet.Finalize();
+			if (packet.coherent) {
+				packetHits.Reset(packet.size, Infinity);
+				settings.objects->IntersectionPacket(packet, 0.001f, packet.FullMask(), packetHits);
+				for (size_t i = 0; i < count; ++i) {
+					if ((packetHits.mask >> i) & 1) onHit(k + i, packetHits.records[i]);
+					else onMiss(k + i);
+				}
+				continue;
+			}
+		}
+		for (size_t i = k; i < k + count; ++i) {
+			IntersectionRecord rec;
+			if (settings.objects->Intersection(queue.Get(i), 0.001f, Infinity, rec)) onHit(i, rec);
+			else onMiss(i);
+		}
+	}
+}
+
+void WavefrontIntegrator::Extend(uint32_t bounce, const FrameSettings& settings, PathStats& stats) {
+	if (hits.size() < rays.Size()) {
+		hits.resize(rays.Size());
+		hitRays.resize(rays.Size());
+	}
+	hitCount = 0;
+	auto start = std::chrono::steady_clock::now();
+	Trace(rays, bounce == 0, settings,
+		[&](size_t k, const IntersectionRecord& rec) {
+			hits[hitCount] = rec;
+			hitRays[hitCount++] = static_cast<uint32_t>(k);
+		},
+		[&](size_t k) {
+			auto p = rays.path[k];
+			paths.AddRadiance(p, paths.Throughput(p) * settings.backgroundColor);
+		});
+	stats.segments += rays.Size();
+	if (bounce > 0) {
+		stats.secondaryRays += rays.Size();
+		stats.secondaryNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+//Bins by direction octant first, then orders each bin along the Morton curve of the
+//ray origins quantized to a 512^3 grid over the scene bounds. Octant and Morton code
+//take 30 bits, so they fit above the 32 bit ray index of the sort key.
+void WavefrontIntegrator::SortRays(RayQueue& queue) {
+	auto n = queue.Size();
+	auto low = sceneBounds.Min();
+	auto extent = sceneBounds.Max() - sceneBounds.Min();
+	sortKeys.resize(n);
+	for (size_t k = 0; k < n; ++k) {
+		Float origin[3] = { queue.ox[k], queue.oy[k], queue.oz[k] };
+		uint32_t cell[3];
+		for (int a = 0; a < 3; ++a) {
+			Float t = extent[a] > 0 ? (origin[a] - low[a]) / extent[a] : 0;
+			cell[a] = static_cast<uint32_t>(Clamp<Float>(t * 512, 0, 511));
+		}
+		uint32_t octant = (queue.dx[k] < 0) | (queue.dy[k] < 0) << 1 | (queue.dz[k] < 0) << 2;
+		uint64_t key = uint64_t(octant) << 27 | EncodeMorton3(cell[0], cell[1], cell[2]);
+		sortKeys[k] = key << 32 | k;
+	}
+	std::sort(sortKeys.begin(), sortKeys.end());
+
+	sortedRays.Clear();
+	sortedRays.Reserve(n);
+	for (auto key : sortKeys) {
+		auto k = static_cast<size_t>(key & 0xffffffff);
+		sortedRays.Push(queue.Get(k), queue.path[k]);
+	}
+	std::swap(queue, sortedRays);
+}
+
+//Hits are grouped by material type and each group is shaded by a loop that knows
+//the concrete material, so the common materials never go through the Material vtable
+//and Lambertian hits need no PDF allocation. Other materials take the generic path.
+void WavefrontIntegrator::Shade(uint32_t bounce, const FrameSettings& settings, PathStats& stats) {
+	nextRays.Clear();
+	shadows.Clear();
+
+	//counting sort of the hit indices by material type
+	const int typeCount = static_cast<int>(MaterialType::Count);
+	uint32_t offsets[typeCount + 1] = {};
+	for (size_t h = 0; h < hitCount; ++h)
+		++offsets[static_cast<int>(hits[h].matPtr->type) + 1];
+	for (int t = 0; t < typeCount; ++t)
+		offsets[t + 1] += offsets[t];
+	shadeOrder.resize(hitCount);
+	uint32_t cursor[typeCount];
+	std::copy(offsets, offsets + typeCount, cursor);
+	for (size_t h = 0; h < hitCount; ++h)
+		shadeOrder[cursor[static_cast<int>(hits[h].matPtr->type)]++] = static_cast<uint32_t>(h);
+
+	//only camera rays carry differentials, later bounces filter at full resolution
+	for (size_t h = 0; h < hitCount; ++h) {
+		if (bounce == 0) hits[h].ComputeDifferentials(settings.CameraDifferential(rays.Get(hitRays[h])));
+		else hits[h].ClearDifferentials();
+	}
+
+	ShadeContext context{ settings, stats,
+		settings.lightSampler && !settings.lightSampler->Empty(),
+		settings.russianRouletteDepth > 0 && bounce + 1 >= settings.russianRouletteDepth };
+	auto group = [&](MaterialType type, uint32_t& first, uint32_t& last) {
+		first = offsets[static_cast<int>(type)];
+		last = offsets[static_cast<int>(type) + 1];
+	};
+	uint32_t first, last;
+	group(MaterialType::DiffuseLight, first, last);
+	ShadeDiffuseLights(first, last, context);
+	group(MaterialType::Lambertian, first, last);
+	ShadeLambertians(first, last, context);
+	group(MaterialType::Metal, first, last);
+	ShadeSpecular<Metal>(first, last, context);
+	group(MaterialType::Dielectric, first, last);
+	ShadeSpecular<Dielectric>(first, last, context);
+	group(MaterialType::Other, first, last);
+	ShadeGeneric(first, last, context);
+}
+
+inline void WavefrontIntegrator::ResumePath(uint32_t p) {
+	sampler->StartPixelSample(Point2i(paths.pixel[p], line), paths.sampleIndex[p], paths.dimension[p]);
+}
+
+//MIS weighted against the light sample taken at the previous diffuse hit.
+inline void WavefrontIntegrator::AddEmission(uint32_t p, const Ray& r, const Color& emitted, const ShadeContext& context) {
+	if (IsBlack(emitted)) return;
+	Float weight = 1;
+	if (!paths.specularBounce[p] && context.hasLights)
+		weight = PowerHeuristic(paths.bsdfPdf[p], context.settings.lightSampler->PDFValue(paths.LastHit(p), r.direction));
+	paths.AddRadiance(p, paths.Throughput(p) * emitted * weight);
+}
+
+//Russian roulette, then queues next as the continuation ray of path p.
+inline void WavefrontIntegrator::ContinuePath(uint32_t p, Color throughput, const Ray& next, ShadeContext& context) {
+	if (context.roulette) {
+		Float survival = std::min<Float>(0.95f, std::max({ throughput.x, throughput.y, throughput.z }));
+		if (sampler->Get1D() >= survival) {
+			++context.stats.terminated;
+			return;
+		}
+		throughput /= survival;
+	}
+	paths.SetThroughput(p, throughput);
+	paths.dimension[p] = sampler->Dimension();
+	nextRays.Push(next, p);
+}
+
+//Shadow ray towards a light sample for next event estimation, false when the
+//sample can not contribute.
+inline bool WavefrontIntegrator::SampleLight(const IntersectionRecord& rec, const Ray& r, Ray& shadow, Float& lightPdf, const ShadeContext& context) {
+	auto uLight = sampler->Get1D();
+	shadow = rec.SpawnRay(context.settings.lightSampler->Generate(rec.hitPoint, uLight, sampler->Get2D()), r.time);
+	lightPdf = context.settings.lightSampler->PDFValue(rec.hitPoint, shadow.direction);
+	return lightPdf > 0;
+}
+
+void WavefrontIntegrator::ShadeDiffuseLights(uint32_t first, uint32_t last, ShadeContext& context) {
+	for (uint32_t s = first; s < last; ++s) {
+		const auto& rec = hits[shadeOrder[s]];
+		Ray r = rays.Get(hitRays[shadeOrder[s]]);
+		auto p = rays.path[hitRays[shadeOrder[s]]];
+		auto light = static_cast<const DiffuseLight*>(rec.matPtr.get());
+		AddEmission(p, r, light->DiffuseLight::Emitted(r, rec, rec.u, rec.v, rec.hitPoint), context);
+	}
+}
+
+//Cosine sampling of a Lambertian lobe: scattering pdf and sampling pdf are the same
+//cos/pi, so the continuation weight is just the albedo.
+void WavefrontIntegrator::ShadeLambertians(uint32_t first, uint32_t last, ShadeContext& context) {
+	for (uint32_t s = first; s < last; ++s) {
+		const auto& rec = hits[shadeOrder[s]];
+		Ray r = rays.Get(hitRays[shadeOrder[s]]);
+		auto p = rays.path[hitRays[shadeOrder[s]]];
+		auto material = static_cast<const Lambertian*>(rec.matPtr.get());
+		ResumePath(p);
+		Color throughput = paths.Throughput(p);
+		Color attenuation = material->albedo->FilteredValue(rec);
+
+		Ray shadow;
+		Float lightPdf;
+		if (context.hasLights && SampleLight(rec, r, shadow, lightPdf, context)) {
+			auto cosine = Dot(rec.normal, shadow.direction.Normalize());
+			if (cosine > 0) {
+				auto scatteringPdf = cosine / Pi;
+				auto weight = PowerHeuristic(lightPdf, scatteringPdf);
+				shadows.Push(shadow, p, throughput * attenuation * (scatteringPdf * weight / lightPdf));
+			}
+		}
+
+		OrthonormalBasis uvw;
+		uvw.BuildFromW(rec.normal);
+		auto u = sampler->Get2D();
+		Ray next = rec.SpawnRay(uvw.Local(RandomCosineDirection(u.x, u.y)), r.time);
+		auto pdf = Dot(next.direction.Normalize(), uvw.w()) / Pi;
+		if (pdf <= 0)
+			continue;
+		paths.bsdfPdf[p] = pdf;
+		paths.SetLastHit(p, rec.hitPoint);
+		paths.specularBounce[p] = 0;
+		ContinuePath(p, throughput * attenuation, next, context);
+	}
+}
+
+//Metal and Dielectric: a single specular continuation, no light sampling.
+template <typename SpecularMaterial>
+void WavefrontIntegrator::ShadeSpecular(uint32_t first, uint32_t last, ShadeContext& context) {
+	for (uint32_t s = first; s < last; ++s) {
+		const auto& rec = hits[shadeOrder[s]];
+		Ray r = rays.Get(hitRays[shadeOrder[s]]);
+		auto p = rays.path[hitRays[shadeOrder[s]]];
+		auto material = static_cast<const SpecularMaterial*>(rec.matPtr.get());
+		ResumePath(p);
+		ScatterRecord srec;
+		if (!material->SpecularMaterial::Scatter(r, rec, srec))
+			continue;
+		paths.specularBounce[p] = 1;
+		ContinuePath(p, paths.Throughput(p) * srec.attenuation, srec.specularRay, context);
+	}
+}
+
+//Any other material, through the virtual interface like RayColor.
+void WavefrontIntegrator::ShadeGeneric(uint32_t first, uint32_t last, ShadeContext& context) {
+	for (uint32_t s = first; s < last; ++s) {
+		const auto& rec = hits[shadeOrder[s]];
+		Ray r = rays.Get(hitRays[shadeOrder[s]]);
+		auto p = rays.path[hitRays[shadeOrder[s]]];
+		ResumePath(p);
+		AddEmission(p, r, rec.matPtr->Emitted(r, rec, rec.u, rec.v, rec.hitPoint), context);
+
+		ScatterRecord srec;
+		if (!rec.matPtr->Scatter(r, rec, srec))
+			continue;
+
+		Color throughput = paths.Throughput(p);
+		if (srec.isSpecular) {
+			paths.specularBounce[p] = 1;
+			ContinuePath(p, throughput * srec.attenuation, srec.specularRay, context);
+			continue;
+		}
+
+		Ray shadow;
+		Float lightPdf;
+		if (context.hasLights && SampleLight(rec, r, shadow, lightPdf, context)) {
+			auto scatteringPdf = rec.matPtr->ScatteringPDF(r, rec, shadow);
+			if (scatteringPdf > 0) {
+				auto weight = PowerHeuristic(lightPdf, srec.pdfPtr->Value(shadow.direction));
+				shadows.Push(shadow, p, throughput * srec.attenuation * (scatteringPdf * weight / lightPdf));
+			}
+		}
+
+		Ray next = rec.SpawnRay(srec.pdfPtr->Generate(sampler->Get2D()), r.time);
+		auto pdf = srec.pdfPtr->Value(next.direction);
+		if (pdf <= 0)
+			continue;
+		paths.bsdfPdf[p] = pdf;
+		paths.SetLastHit(p, rec.hitPoint);
+		paths.specularBounce[p] = 0;
+		ContinuePath(p, throughput * srec.attenuation * rec.matPtr->ScatteringPDF(r, rec, next) / pdf, next, context);
+	}
+}
+
+//Whatever a shadow ray hits first is the emitter, an occluder emits nothing.
+void WavefrontIntegrator::TraceShadowRays(const FrameSettings& settings) {
+	Trace(shadows.rays, true, settings,
+		[&](size_t k, const IntersectionRecord& lightRec) {
+			Ray shadow = shadows.rays.Get(k);
+			Color emitted = lightRec.matPtr->Emitted(shadow, lightRec, lightRec.u, lightRec.v, lightRec.hitPoint);
+			if (!IsBlack(emitted))
+				paths.AddRadiance(shadows.rays.path[k], shadows.Contribution(k) * emitted);
+		},
+		[](size_t) {});
+}
@@ -13,8 +13,16 @@ public:
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override;
+	virtual void IntersectionPacket(const RayPacket& packet, Float tMin, uint32_t active, PacketHits& hits) const override {
+		for (const auto& object : objects)
+			object->IntersectionPacket(packet, tMin, active, hits);
+	}
 	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const;
-	virtual Vector3f ShapeRandom(const Point3f& o) const;
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override;
+	using Shape::ShapeRandom;
+	virtual void GetChildren(std::vector<std::shared_ptr<Shape>>& children) const override {
+		children.insert(children.end(), objects.begin(), objects.end());
+	}
 public:
 	std::vector<std::shared_ptr<Shape>> objects;
 };
@@ -44,9 +52,10 @@ Float ShapesSet::PDFValue(const Point3f & o, const Vector3f & v) const{
 	return sum;
 }
 
-Vector3f ShapesSet::ShapeRandom(const Point3f & o) const{
+Vector3f ShapesSet::ShapeRandom(const Point3f & o, const Point2f& u) const{
 	auto intSize = static_cast<int>(objects.size());
-	return objects[RandomInt(0, intSize - 1)]->ShapeRandom(o);
+	auto index = std::min(static_cast<int>(u.x * intSize), intSize - 1);
+	return objects[index]->ShapeRandom(o, Point2f(u.x * intSize - index, u.y));
 }
 
 bool ShapesSet::Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const {
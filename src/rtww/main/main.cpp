@@ -11,43 +11,103 @@
 #include "core/PDF.hpp"
 #include "core/ThreadPool.h"
 #include "core/Frame.hpp"
+#include "core/Wavefront.hpp"
 #include "core/Transform.hpp"
 #include "core/Model.hpp"
 #include "shape/Triangle.hpp"
 #include <thread>
 #include <Windows.h>
 
-Color RayColor(const Ray& r, const Color& background, std::shared_ptr <ShapesSet> world, std::shared_ptr<Shape> lights, int depth) {
-	IntersectionRecord rec;
+//Direct light at a diffuse hit from one light sample and a shadow ray, weighted
+//against BSDF sampling with the power heuristic.
+Color SampleDirectLight(const Ray& r, const IntersectionRecord& rec, const ScatterRecord& srec,
+	const FrameSettings& settings, Sampler& sampler) {
+	auto uLight = sampler.Get1D();
+	Ray shadow = rec.SpawnRay(settings.lightSampler->Generate(rec.hitPoint, uLight, sampler.Get2D()), r.time);
+	auto lightPdf = settings.lightSampler->PDFValue(rec.hitPoint, shadow.direction);
+	if (lightPdf <= 0) return Color(0, 0, 0);
+	auto scatteringPdf = rec.matPtr->ScatteringPDF(r, rec, shadow);
+	if (scatteringPdf <= 0) return Color(0, 0, 0);
+
+	//whatever the shadow ray hits first is the emitter, an occluder emits nothing
+	IntersectionRecord lightRec;
+	if (!settings.objects->Intersection(shadow, 0.001f, Infinity, lightRec)) return Color(0, 0, 0);
+	Color emitted = lightRec.matPtr->Emitted(shadow, lightRec, lightRec.u, lightRec.v, lightRec.hitPoint);
+	if (IsBlack(emitted)) return Color(0, 0, 0);
+
+	auto weight = PowerHeuristic(lightPdf, srec.pdfPtr->Value(shadow.direction));
+	return srec.attenuation * emitted * (scatteringPdf * weight / lightPdf);
+}
 
-	if (depth <= 0)
-		return Color(0, 0, 0);
+//Iterative path tracer with next-event estimation. Diffuse hits sample the lights
+//explicitly (SampleDirectLight) and continue along a BSDF sample; emitters hit by
+//that BSDF sample are MIS weighted so light is not counted twice. After
+//settings.russianRouletteDepth bounces (0 disables it) paths survive with
+//probability equal to their largest throughput component and are reweighted by
+//its inverse, which keeps the estimate unbiased.
+Color RayColor(const Ray& cameraRay, const RayDifferential& differential, const FrameSettings& settings, Sampler& sampler, PathStats& stats) {
+	Color radiance(0, 0, 0);
+	Color throughput(1, 1, 1);
+	Ray r = cameraRay;
+	bool hasLights = settings.lightSampler && !settings.lightSampler->Empty();
+	bool specularBounce = true;	//camera and specular rays have no light sampling to balance against
+	Float bsdfPdf = 0;
+	Point3f lastHit;
+	++stats.paths;
+
+	for (uint32_t bounce = 0; bounce < settings.rayTracingDepth; ++bounce) {
+		++stats.segments;
+		IntersectionRecord rec;
+		if (!settings.objects->Intersection(r, 0.001f, Infinity, rec)) {
+			//auto t = 0.5*(r.direction.Normalize().y + 1.0);
+			//return (1.0 - t)* Color(1.0, 1.0, 1.0) + t *  Color(0.5, 0.7, 1.0);
+			radiance += throughput * settings.backgroundColor;
+			break;
+		}
+		//texture filters follow the camera ray's pixel footprint, later bounces filter at full resolution
+		if (bounce == 0) rec.ComputeDifferentials(differential);
+
+		Color emitted = rec.matPtr->Emitted(r, rec, rec.u, rec.v, rec.hitPoint);
+		if (!IsBlack(emitted)) {
+			Float weight = 1;
+			if (!specularBounce && hasLights)
+				weight = PowerHeuristic(bsdfPdf, settings.lightSampler->PDFValue(lastHit, r.direction));
+			radiance += throughput * emitted * weight;
+		}
 
-	if (!world->Intersection(r, 0.001f, Infinity, rec)) {
-		//auto t = 0.5*(r.direction.Normalize().y + 1.0);
-		//return (1.0 - t)* Color(1.0, 1.0, 1.0) + t *  Color(0.5, 0.7, 1.0);
-		return background;
-	}
+		ScatterRecord srec;
+		if (!rec.matPtr->Scatter(r, rec, srec))
+			break;
 
-	ScatterRecord srec;
-	Color emitted = rec.matPtr->Emitted(r, rec, rec.u, rec.v, rec.hitPoint);
-	if (!rec.matPtr->Scatter(r, rec, srec))
-		return emitted;
+		if (srec.isSpecular) {
+			throughput = throughput * srec.attenuation;
+			r = srec.specularRay;
+			specularBounce = true;
+		}
+		else {
+			if (hasLights)
+				radiance += throughput * SampleDirectLight(r, rec, srec, settings, sampler);
+
+			Ray scattered = rec.SpawnRay(srec.pdfPtr->Generate(sampler.Get2D()), r.time);
+			bsdfPdf = srec.pdfPtr->Value(scattered.direction);
+			if (bsdfPdf <= 0)
+				break;
+			throughput = throughput * srec.attenuation * rec.matPtr->ScatteringPDF(r, rec, scattered) / bsdfPdf;
+			r = scattered;
+			lastHit = rec.hitPoint;
+			specularBounce = false;
+		}
 
-	if (srec.isSpecular) {
-		return srec.attenuation
-			* RayColor(srec.specularRay, background, world, lights, depth - 1);
+		if (settings.russianRouletteDepth > 0 && bounce + 1 >= settings.russianRouletteDepth) {
+			Float survival = std::min<Float>(0.95f, std::max({ throughput.x, throughput.y, throughput.z }));
+			if (sampler.Get1D() >= survival) {
+				++stats.terminated;
+				break;
+			}
+			throughput /= survival;
+		}
 	}
-
-	auto light_ptr = std::make_shared<ShapePDF>(lights, rec.hitPoint);
-	MixturePDF p(light_ptr, srec.pdfPtr);
-
-	Ray scattered = Ray(rec.hitPoint, p.Generate(), r.time);
-	auto pdf_val = p.Value(scattered.direction);
-
-	return emitted
-		+ srec.attenuation * rec.matPtr->ScatteringPDF(r, rec, scattered)
-		* RayColor(scattered, background, world, lights, depth - 1) / pdf_val;
+	return radiance;
 }
 
 ShapesSet CornellBox2() {
@@ -202,10 +262,6 @@ ShapesSet CornellBoxModel() {
 	//		modelT.Add(triangles[i]);
 	//}
 	//objects.Add(std::make_shared<BVHNode>(modelT, 0, 1));
-	Vector3f vertices[6] = { Vector3f(-1.000000, -1.000000, 1.000000) ,Vector3f(1.000000, -1.000000, 1.000000) ,Vector3f(-1.000000, 1.000000, 1.000000),
-					  Vector3f(-1.000000, 1.000000, 1.000000) ,Vector3f(1.000000, -1.000000, 1.000000) ,Vector3f(1.000000, 1.000000, 1.000000) };
-	int vertexIndices
-
 
 	//std::shared_ptr<Shape> box = std::make_shared<Box>(std::make_shared<Transform>(
 	//	Point3f(0, -250, 650), Vector3f(500, 500, 500), Vector3f(0, 50, 0)), whiteG);
@@ -213,33 +269,109 @@ ShapesSet CornellBoxModel() {
 	return objects;
 }
 
-std::vector<Color> Draw(int index, std::shared_ptr<FrameSettings> settings) {
-	std::vector<Color> t(settings->imageWidth, Color(0, 0, 0));
+void WriteFirstHitAOVs(int i, int index, std::shared_ptr<FrameSettings> settings) {
+	auto& fb = *settings->framebuffer;
+	auto u = (i + 0.5f) / (settings->imageWidth - 1);
+	auto v = (index + 0.5f) / (settings->imageHeight - 1);
+	Ray r = settings->camera->GenerateRay(u, v);
+	IntersectionRecord rec;
+	if (!settings->objects->Intersection(r, 0.001f, Infinity, rec)) return;
+	rec.ComputeDifferentials(settings->CameraDifferential(r));
+
+	if (fb.HasAOV(AOV_Normal)) fb.SetNormal(i, index, rec.normal);
+	if (fb.HasAOV(AOV_Albedo)) {
+		ScatterRecord srec;
+		fb.SetAlbedo(i, index, rec.matPtr->Scatter(r, rec, srec) ? srec.attenuation
+			: rec.matPtr->Emitted(r, rec, rec.u, rec.v, rec.hitPoint));
+	}
+}
+
+Color SamplePixel(int i, int index, uint32_t sampleIndex, Sampler& sampler, PathStats& stats, std::shared_ptr<FrameSettings> settings) {
+	sampler.StartPixelSample(Point2i(i, index), sampleIndex);
+	auto jitter = sampler.Get2D();
+	auto u = Float(i + jitter.x) / (settings->imageWidth - 1);
+	auto v = Float(index + jitter.y) / (settings->imageHeight - 1);
+	Ray r = settings->camera->GenerateRay(u, v, sampler.Get2D());
+	return RayColor(r, settings->CameraDifferential(r), *settings, sampler, stats);
+}
+
+//Adds up to samples more to every pixel of the line that has not converged yet,
+//so progressive passes skip pixels that converged in an earlier pass. Inside
+//RenderAdaptive the pixels sample up to their adaptiveTargets instead.
+void DrawAdaptive(int index, uint32_t samples, std::shared_ptr<FrameSettings> settings) {
+	auto& fb = *settings->framebuffer;
+	const auto& adaptive = settings->adaptive;
+	auto maxSamples = settings->MaxAdaptiveSamples();
+	auto sampler = CreateSampler(settings->samplerType, settings->samplesPerPixel, settings->samplerSeed);
+	PathStats stats;
+	bool budgeted = !settings->adaptiveTargets.empty();
+	uint64_t rays = 0;
 	for (int i = 0; i < settings->imageWidth; ++i) {
-		Color pixelColor(0, 0, 0);
-		for (uint32_t k = 0; k < settings->samplesPerPixel; ++k) {
-			auto u = Float(i + Random<Float>()) / (settings->imageWidth - 1);
-			auto v = Float(index + Random<Float>()) / (settings->imageHeight - 1);
-			Ray r = settings->camera->GenerateRay(u, v);
-			pixelColor += RayColor(r, settings->backgroundColor, settings->objects, settings->lights, settings->rayTracingDepth);
+		uint32_t start = fb.SampleCount(i, index);
+		uint32_t n = start;
+		uint32_t limit = budgeted ? settings->adaptiveTargets[size_t(index) * settings->imageWidth + i] : std::min(maxSamples, start + samples);
+		while (n < limit) {
+			if (n >= adaptive.minSamples && fb.RelativeError(i, index) < adaptive.errorThreshold)
+				break;
+			for (uint32_t k = 0; k < adaptive.batchSize && n < limit; ++k, ++n)
+				fb.AddSample(i, index, SamplePixel(i, index, n, *sampler, stats, settings));
 		}
-		t[i] = pixelColor;
+		rays += n - start;
+		if (start == 0 && settings->aovs != AOV_None) WriteFirstHitAOVs(i, index, settings);
+	}
+	//RenderAdaptive counts its progress in samples
+	settings->progress.AddWork(budgeted ? rays : 1, rays);
+	settings->progress.AddPaths(stats);
+}
+
+void Draw(int index, uint32_t samples, std::shared_ptr<FrameSettings> settings) {
+	if (settings->adaptive.enabled) {
+		DrawAdaptive(index, samples, settings);
+		return;
+	}
+	auto& fb = *settings->framebuffer;
+	auto sampler = CreateSampler(settings->samplerType, settings->samplesPerPixel, settings->samplerSeed);
+	PathStats stats;
+	bool firstPass = fb.SampleCount(0, index) == 0;
+	for (int i = 0; i < settings->imageWidth; ++i) {
+		Color pixelColor(0, 0, 0);
+		uint32_t start = fb.SampleCount(i, index);
+		for (uint32_t k = 0; k < samples; ++k)
+			pixelColor += SamplePixel(i, index, start + k, *sampler, stats, settings);
+		fb.AddSamples(i, index, pixelColor, samples);
+		if (firstPass && settings->aovs != AOV_None) WriteFirstHitAOVs(i, index, settings);
+	}
+	settings->progress.AddWork(1, uint64_t(settings->imageWidth) * samples);
+	settings->progress.AddPaths(stats);
+}
+
+//Same contract as Draw with the paths of the line traced breadth-first. Adaptive
+//sampling decides per pixel between small batches, so it keeps the depth-first path.
+void DrawWavefront(int index, uint32_t samples, std::shared_ptr<FrameSettings> settings) {
+	if (settings->adaptive.enabled) {
+		DrawAdaptive(index, samples, settings);
+		return;
+	}
+	thread_local WavefrontIntegrator integrator;
+	auto& fb = *settings->framebuffer;
+	PathStats stats;
+	bool firstPass = fb.SampleCount(0, index) == 0;
+	integrator.RenderLine(index, samples, *settings, stats);
+	if (firstPass && settings->aovs != AOV_None) {
+		for (int i = 0; i < settings->imageWidth; ++i)
+			WriteFirstHitAOVs(i, index, settings);
 	}
-	consoleMutex.lock();
-	std::cerr << "Line " << index << " is done.\n";
-	consoleMutex.unlock();
-	return t;
+	settings->progress.AddWork(1, uint64_t(settings->imageWidth) * samples);
+	settings->progress.AddPaths(stats);
 }
 
 int main(int argc, char** argv) {
-	auto lights = std::make_shared<ShapesSet>();
-	lights->Add(std::make_shared<Sphere>(std::make_shared<Transform>(
-		Point3f(0, 850, 500), Vector3f(100, 100, 100), Vector3f(0, 0, 0)), std::shared_ptr<Material>()));
 	fs::path imageParentPath("D:/Workspace/CG/Repos/Rtww-offline/build/x64/Release/Triangles");
 	if (!fs::exists(imageParentPath)) {
 		fs::create_directory(imageParentPath);
 	}
 	FrameRenderer renderer("Triangles", imageParentPath, 20, 8);
+	renderer.SetProgressOptions(ProgressMode::Normal, 2000);
 	
 	Color background(0, 0, 0);
 	Vector3f vup(0, 1, 0);
@@ -251,9 +383,12 @@ int main(int argc, char** argv) {
 	
 	auto settings = std::make_shared<FrameSettings>();
 	settings->SetImageOptions(400, 400);
-	settings->SetRayTraceOptions(20, 1000);
+	settings->SetRayTraceOptions(20, 1000, 3);
+	settings->SetSamplerOptions(SamplerType::Sobol);
+	//adaptive sampling is opt in, it moves samples of the same budget from converged pixels to noisy ones
+	//settings->SetAdaptiveOptions(0.02f, 64);
 	settings->SetScene(std::make_shared<Camera>(lookfrom, lookat, vup, vfov, 1.0f, aperture, dist2Focus),
-		std::make_shared<ShapesSet>(CornellBoxModel()), lights, background);
+		std::make_shared<ShapesSet>(CornellBoxModel()), background);
 	renderer.AddFrame(settings);
 	
 	renderer.Render(Draw, 0, 1);
@@ -10,20 +10,38 @@ public:
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override {
-		auto center = transform->GetPosition();
-		auto xl = transform->GetScale().x * 0.5f;
-		auto yl = transform->GetScale().y * 0.5f;
-		auto zl = transform->GetScale().z * 0.5f;
-		outputBox = AABB(Point3f(center.x - xl, center.y - yl, center.z - zl), center + Point3f(center.x + xl, center.y + yl, center.z + zl));
+		auto first = transform->ToWorld(Point3f(-0.5f, -0.5f, -0.5f));
+		auto bounds = Bounds3f(first, first);
+		for (int corner = 1; corner < 8; ++corner)
+			bounds = Union(bounds, transform->ToWorld(Point3f(corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f, corner & 4 ? 0.5f : -0.5f)));
+		outputBox = AABB(bounds.pMin, bounds.pMax);
 		return true;
 	}
+	//The box is sampled as one light over its six faces rather than handing the object
+	//space sides out as separate lights.
+	virtual Float Area() const override { return 2 * (faceArea[0] + faceArea[1] + faceArea[2]); }
+	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const override;
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override;
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual bool IsSamplable() const override { return true; }
 
 public:
 	ShapesSet sides;
+	std::shared_ptr<Material> material;
+
+private:
+	Float faceArea[3];	//world space area of one face across each object axis
 };
 
-Box::Box(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) {
+Box::Box(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) : material(mat) {
 	this->transform = transform;
+	auto x = transform->ToWorld(Vector3f(1, 0, 0));
+	auto y = transform->ToWorld(Vector3f(0, 1, 0));
+	auto z = transform->ToWorld(Vector3f(0, 0, 1));
+	faceArea[0] = Cross(y, z).Length();
+	faceArea[1] = Cross(x, z).Length();
+	faceArea[2] = Cross(x, y).Length();
 	
 	sides.Add(std::make_shared<RectangleXY>(std::make_shared<Transform>(Point3f(0, 0, 0.5), Vector3f(1.0f, 1.0f, 0.03f), Vector3f()), mat));
 	sides.Add(std::make_shared<RectangleXY>(std::make_shared<Transform>(Point3f(0, 0, -0.5), Vector3f(1.0f, 1.0f, 0.03f), Vector3f()), mat));
@@ -36,10 +54,59 @@ Box::Box(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) {
 }
 
 bool Box::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	Ray ray = transform->GetWorld2ObjectMatrix()(r);
-	auto hit = sides.Intersection(ray, tMin, tMax, rec);
-	auto outwardNormal = transform->GetObject2WorldMatrix()(rec.normal);
-	rec.SetFaceNormal(ray, outwardNormal);
-	rec.hitPoint = transform->GetObject2WorldMatrix()(ray.At(rec.time));
-	return hit;
-}
\ No newline at end of file
+	Ray ray = transform->ToObject(r);
+	if (!sides.Intersection(ray, tMin, tMax, rec))
+		return false;
+	//the side already faced the normal against the ray, the normal transform keeps that
+	rec.normal = transform->NormalToWorld(rec.normal).Normalize();
+	rec.hitPoint = transform->ToWorld(ray.At(rec.time));
+	rec.dpdu = transform->ToWorld(rec.dpdu);
+	rec.dpdv = transform->ToWorld(rec.dpdv);
+	return true;
+}
+
+Float Box::PDFValue(const Point3f& o, const Vector3f& v) const {
+	//slab test on the unit cube, keeping the axis of the faces the ray enters and leaves by
+	Ray ray = transform->ToObject(Ray(o, v));
+	Float tEnter = -Infinity, tExit = Infinity;
+	int enterAxis = 0, exitAxis = 0;
+	for (int i = 0; i < 3; ++i) {
+		auto invD = 1.0f / ray.direction[i];
+		auto t0 = (-0.5f - ray.origin[i]) * invD;
+		auto t1 = (0.5f - ray.origin[i]) * invD;
+		if (invD < 0.0f) std::swap(t0, t1);
+		if (t0 > tEnter) { tEnter = t0; enterAxis = i; }
+		if (t1 < tExit) { tExit = t1; exitAxis = i; }
+	}
+	if (tExit <= tEnter)
+		return 0;
+
+	//every face point along the direction could have been sampled, so both crossings count
+	auto area = Area();
+	auto crossing = [&](Float t, int axis) -> Float {
+		if (t < 0.001)
+			return 0;
+		auto normal = transform->NormalToWorld(Vector3f(axis == 0, axis == 1, axis == 2)).Normalize();
+		auto distanceSquared = t * t * v.LengthSquared();
+		auto cosine = fabs(Dot(v, normal) / v.Length());
+		return distanceSquared / (cosine * area);
+	};
+	return crossing(tEnter, enterAxis) + crossing(tExit, exitAxis);
+}
+
+Vector3f Box::ShapeRandom(const Point3f& o, const Point2f& u) const {
+	//pick a face in proportion to its area and reuse what is left of u.x inside it
+	auto x = u.x * Area();
+	int axis = 0;
+	while (axis < 2 && x >= 2 * faceArea[axis])
+		x -= 2 * faceArea[axis++];
+	Float side = -0.5f;
+	if (x >= faceArea[axis]) {
+		side = 0.5f;
+		x -= faceArea[axis];
+	}
+	Float s = std::min(x / faceArea[axis], Float(1)) - 0.5f;
+	Float t = u.y - 0.5f;
+	auto randomPoint = transform->ToWorld(axis == 0 ? Point3f(side, s, t) : axis == 1 ? Point3f(s, side, t) : Point3f(s, t, side));
+	return randomPoint - o;
+}
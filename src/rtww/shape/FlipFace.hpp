@@ -19,6 +19,14 @@ public:
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override {
 		return ptr->BoundingBox(time0, time1, outputBox);
 	}
+
+	virtual Float Area() const override { return ptr->Area(); }
+	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const override { return ptr->PDFValue(o, v); }
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override { return ptr->ShapeRandom(o, u); }
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return ptr->GetMaterial(); }
+	virtual void GetChildren(std::vector<std::shared_ptr<Shape>>& children) const override { ptr->GetChildren(children); }
+	virtual bool IsSamplable() const override { return ptr->IsSamplable(); }
 public:
 	std::shared_ptr<Shape> ptr;
 };
\ No newline at end of file
@@ -7,23 +7,47 @@ public:
 	RectangleXY() {}
 	RectangleXY(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) : material(mat) {
 		this->transform = transform;
+		this->area = Cross(transform->ToWorld(Vector3f(1, 0, 0)), transform->ToWorld(Vector3f(0, 1, 0))).Length();
 	}
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override {
-		auto center = transform->GetPosition();
-		auto xl = transform->GetScale().x * 0.5f;
-		auto yl = transform->GetScale().y * 0.5f;
-		outputBox = AABB(Point3f(center.x - xl, center.y - yl, center.z - 0.0001f), Point3f(center.x + xl, center.y + yl, center.z + 0.0001f));
+		//corners of the transformed square, a rotated light has to be bounded for the light BVH
+		auto first = transform->ToWorld(Point3f(-0.5f, -0.5f, 0));
+		auto bounds = Bounds3f(first, first);
+		for (int corner = 1; corner < 4; ++corner)
+			bounds = Union(bounds, transform->ToWorld(Point3f(corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f, 0)));
+		outputBox = AABB(bounds.pMin - Vector3f(0.0001f, 0.0001f, 0.0001f), bounds.pMax + Vector3f(0.0001f, 0.0001f, 0.0001f));
 		return true;
 	}
+	virtual Float Area() const override { return area; }
+	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const {
+		IntersectionRecord rec;
+		if (!this->Intersection(Ray(o, v), 0.001, Infinity, rec))
+			return 0;
+
+		auto distanceSquared = rec.time * rec.time * v.LengthSquared();
+		auto cosine = fabs(Dot(v, rec.normal) / v.Length());
+
+		return distanceSquared / (cosine * area);
+	}
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override {
+		auto randomPoint = transform->ToWorld(Point3f(u.x - 0.5f, u.y - 0.5f, 0));
+		return randomPoint - o;
+	}
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual bool IsSamplable() const override { return true; }
 
 public:
 	std::shared_ptr<Material> material;
+
+private:
+	Float area;		//world space, the transform may rotate or shear the unit square
 };
 
 bool RectangleXY::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	Ray ray = transform->GetWorld2ObjectMatrix()(r);
+	Ray ray = transform->ToObject(r);
 	auto t = -ray.origin.z / ray.direction.z;
 	if (t < tMin || t > tMax)
 		return false;
@@ -33,11 +57,13 @@ bool RectangleXY::Intersection(const Ray & r, Float tMin, Float tMax, Intersecti
 		return false;
 	rec.u = x + 0.5f;
 	rec.v = y + 0.5f;
+	rec.dpdu = transform->ToWorld(Vector3f(1, 0, 0));
+	rec.dpdv = transform->ToWorld(Vector3f(0, 1, 0));
 	rec.time = t;
-	auto outwardNormal = transform->GetObject2WorldMatrix()(Vector3f(0, 0, 1));
-	rec.SetFaceNormal(ray, outwardNormal);
+	auto outwardNormal = transform->NormalToWorld(Vector3f(0, 0, 1)).Normalize();
+	rec.SetFaceNormal(r, outwardNormal);
 	rec.matPtr = material;
-	rec.hitPoint = transform->GetObject2WorldMatrix()(ray.At(t));;
+	rec.hitPoint = transform->ToWorld(ray.At(t));
 	return true;
 }
 
@@ -46,46 +72,46 @@ public:
 	RectangleXZ() {}
 	RectangleXZ(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) : material(mat) {
 		this->transform = transform;
-		auto center = transform->GetPosition();
-		auto xl = transform->GetScale().x * 0.5f;
-		auto zl = transform->GetScale().z * 0.5f;
-		this->x0 = center.x - xl;
-		this->x1 = center.x + xl;
-		this->z0 = center.z - zl;
-		this->z1 = center.z + zl;
-		this->y = center.y;
+		this->area = Cross(transform->ToWorld(Vector3f(1, 0, 0)), transform->ToWorld(Vector3f(0, 0, 1))).Length();
 	}
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override {
-		outputBox = AABB(Point3f(x0, y - 0.0001f, z0), Point3f(x1, y + 0.0001f, z1));
+		auto first = transform->ToWorld(Point3f(-0.5f, 0, -0.5f));
+		auto bounds = Bounds3f(first, first);
+		for (int corner = 1; corner < 4; ++corner)
+			bounds = Union(bounds, transform->ToWorld(Point3f(corner & 1 ? 0.5f : -0.5f, 0, corner & 2 ? 0.5f : -0.5f)));
+		outputBox = AABB(bounds.pMin - Vector3f(0.0001f, 0.0001f, 0.0001f), bounds.pMax + Vector3f(0.0001f, 0.0001f, 0.0001f));
 		return true;
 	}
+	virtual Float Area() const override { return area; }
 	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const {
 		IntersectionRecord rec;
 		if (!this->Intersection(Ray(o, v), 0.001, Infinity, rec))
 			return 0;
 
-		auto area = (x1 - x0)*(z1 - z0);
 		auto distanceSquared = rec.time * rec.time * v.LengthSquared();
 		auto cosine = fabs(Dot(v, rec.normal) / v.Length());
 
 		return distanceSquared / (cosine * area);
 	}
-	virtual Vector3f ShapeRandom(const Point3f& o) const {
-		auto randomPoint = Point3f(Random<Float>(x0, x1), y, Random<Float>(z0, z1));
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override {
+		auto randomPoint = transform->ToWorld(Point3f(u.x - 0.5f, 0, u.y - 0.5f));
 		return randomPoint - o;
 	}
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual bool IsSamplable() const override { return true; }
 
 public:
 	std::shared_ptr<Material> material;
 
 private:
-	Float x0, x1, z0, z1, y;
+	Float area;		//world space, the transform may rotate or shear the unit square
 };
 
 bool RectangleXZ::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	Ray ray = transform->GetWorld2ObjectMatrix()(r);
+	Ray ray = transform->ToObject(r);
 	auto t = -ray.origin.y / ray.direction.y;
 	if (t < tMin || t > tMax)
 		return false;
@@ -95,11 +121,13 @@ bool RectangleXZ::Intersection(const Ray & r, Float tMin, Float tMax, Intersecti
 		return false;
 	rec.u = x + 0.5f;
 	rec.v = z + 0.5f;
+	rec.dpdu = transform->ToWorld(Vector3f(1, 0, 0));
+	rec.dpdv = transform->ToWorld(Vector3f(0, 0, 1));
 	rec.time = t;
-	auto outwardNormal = transform->GetObject2WorldMatrix()(Vector3f(0, 1, 0));
-	rec.SetFaceNormal(ray, outwardNormal);
+	auto outwardNormal = transform->NormalToWorld(Vector3f(0, 1, 0)).Normalize();
+	rec.SetFaceNormal(r, outwardNormal);
 	rec.matPtr = material;
-	rec.hitPoint = transform->GetObject2WorldMatrix()(ray.At(t));
+	rec.hitPoint = transform->ToWorld(ray.At(t));
 	return true;
 }
 
@@ -108,23 +136,46 @@ public:
 	RectangleYZ() {}
 	RectangleYZ(std::shared_ptr<Transform> transform, std::shared_ptr<Material> mat) : material(mat) {
 		this->transform = transform;
+		this->area = Cross(transform->ToWorld(Vector3f(0, 1, 0)), transform->ToWorld(Vector3f(0, 0, 1))).Length();
 	}
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override {
-		auto center = transform->GetPosition();
-		auto yl = transform->GetScale().y * 0.5f;
-		auto zl = transform->GetScale().z * 0.5f;
-		outputBox = AABB(Point3f(center.x - 0.0001f, center.y - yl, center.z - zl), Point3f(center.x + 0.0001f, center.y + yl, center.z + zl));
+		auto first = transform->ToWorld(Point3f(0, -0.5f, -0.5f));
+		auto bounds = Bounds3f(first, first);
+		for (int corner = 1; corner < 4; ++corner)
+			bounds = Union(bounds, transform->ToWorld(Point3f(0, corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f)));
+		outputBox = AABB(bounds.pMin - Vector3f(0.0001f, 0.0001f, 0.0001f), bounds.pMax + Vector3f(0.0001f, 0.0001f, 0.0001f));
 		return true;
 	}
+	virtual Float Area() const override { return area; }
+	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const {
+		IntersectionRecord rec;
+		if (!this->Intersection(Ray(o, v), 0.001, Infinity, rec))
+			return 0;
+
+		auto distanceSquared = rec.time * rec.time * v.LengthSquared();
+		auto cosine = fabs(Dot(v, rec.normal) / v.Length());
+
+		return distanceSquared / (cosine * area);
+	}
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override {
+		auto randomPoint = transform->ToWorld(Point3f(0, u.x - 0.5f, u.y - 0.5f));
+		return randomPoint - o;
+	}
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual bool IsSamplable() const override { return true; }
 
 public:
 	std::shared_ptr<Material> material;
+
+private:
+	Float area;		//world space, the transform may rotate or shear the unit square
 };
 
 bool RectangleYZ::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	Ray ray = transform->GetWorld2ObjectMatrix()(r);
+	Ray ray = transform->ToObject(r);
 	auto t = -ray.origin.x / ray.direction.x;
 	if (t < tMin || t > tMax)
 		return false;
@@ -134,10 +185,12 @@ bool RectangleYZ::Intersection(const Ray & r, Float tMin, Float tMax, Intersecti
 		return false;
 	rec.u = y + 0.5f;
 	rec.v = z + 0.5f;
+	rec.dpdu = transform->ToWorld(Vector3f(0, 1, 0));
+	rec.dpdv = transform->ToWorld(Vector3f(0, 0, 1));
 	rec.time = t;
-	auto outward_Normal = transform->GetObject2WorldMatrix()(Vector3f(1, 0, 0));
-	rec.SetFaceNormal(ray, outward_Normal);
+	auto outward_Normal = transform->NormalToWorld(Vector3f(1, 0, 0)).Normalize();
+	rec.SetFaceNormal(r, outward_Normal);
 	rec.matPtr = material;
-	rec.hitPoint = transform->GetObject2WorldMatrix()(ray.At(t));
+	rec.hitPoint = transform->ToWorld(ray.At(t));
 	return true;
 }
\ No newline at end of file
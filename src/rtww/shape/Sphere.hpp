@@ -14,18 +14,36 @@ public:
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override;
+	virtual Float Area() const override {
+		auto radius = transform->GetScale()[0];
+		return 4 * Pi * radius * radius;
+	}
 	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const;
-	virtual Vector3f ShapeRandom(const Point3f& o) const;
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override;
+	using Shape::ShapeRandom;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual bool IsSamplable() const override { return true; }
 
 private:
 	static void GetUV(const Point3f& p, Float& u, Float& v) {
-		auto theta = acos(-p.y);
+		auto theta = acos(Clamp<Float>(-p.y, -1.0, 1.0));
 		auto phi = atan2(-p.z, p.x) + Pi;
 
 		u = phi / (2 * Pi);
 		v = theta / Pi;
 	}
 
+	//Derivatives of the unit sphere point p with respect to GetUV's u and v.
+	static void GetUVDerivatives(const Vector3f& p, Vector3f& dpdu, Vector3f& dpdv) {
+		dpdu = 2 * Pi * Vector3f(p.z, 0, -p.x);
+		auto radius = std::sqrt(p.x * p.x + p.z * p.z);
+		if (radius == 0) {
+			dpdv = Vector3f(Pi, 0, 0);
+			return;
+		}
+		dpdv = Pi * Vector3f(-p.x * p.y / radius, radius, -p.y * p.z / radius);
+	}
+
 public:
 	std::shared_ptr<Material> material;
 };
@@ -52,18 +70,18 @@ Float Sphere::PDFValue(const Point3f & o, const Vector3f & v) const{
 	return 1 / solidAngle;
 }
 
-Vector3f Sphere::ShapeRandom(const Point3f & o) const{
+Vector3f Sphere::ShapeRandom(const Point3f & o, const Point2f& u) const{
 	auto center = transform->GetPosition();
 	auto radius = transform->GetScale()[0];
 	Vector3f dir = center - o;
 	auto distanceSquared = dir.LengthSquared();
 	OrthonormalBasis onb;
 	onb.BuildFromW(dir);
-	return onb.Local(Random2Sphere(radius, distanceSquared));
+	return onb.Local(Random2Sphere(radius, distanceSquared, u.x, u.y));
 }
 
 bool Sphere::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	Ray ray = transform->GetWorld2ObjectMatrix()(r);
+	Ray ray = transform->ToObject(r);
 	Vector3f o2c = Convert(ray.origin);
 	auto a = ray.direction.LengthSquared();
 	auto halfB = Dot(o2c, ray.direction);
@@ -80,10 +98,17 @@ bool Sphere::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRec
 	}
 
 	rec.time = root;
-	rec.hitPoint = transform->GetObject2WorldMatrix()(ray.At(root));
-	rec.normal = (rec.hitPoint - transform->GetObject2WorldMatrix()(Point3f()));
-	rec.SetFaceNormal(ray, rec.normal);
-	GetUV(Point3f(rec.normal.x, rec.normal.y, rec.normal.z), rec.u, rec.v);
+	auto objectPoint = ray.At(root);
+	rec.hitPoint = transform->ToWorld(objectPoint);
+	rec.normal = transform->NormalToWorld(Convert(objectPoint)).Normalize();
+	rec.SetFaceNormal(r, rec.normal);
+	//u, v and their derivatives from the same object space point, the outward normal of the
+	//unit sphere: they turn with the sphere and do not flip when the inside is hit
+	auto outward = Convert(objectPoint).Normalize();
+	GetUV(Point3f(outward.x, outward.y, outward.z), rec.u, rec.v);
+	GetUVDerivatives(outward, rec.dpdu, rec.dpdv);
+	rec.dpdu = transform->ToWorld(rec.dpdu);
+	rec.dpdv = transform->ToWorld(rec.dpdv);
 	rec.matPtr = material;
 
 	return true;
@@ -12,10 +12,35 @@ public:
 
 	virtual bool Intersection(const Ray& r, Float tMin, Float tMax, IntersectionRecord& rec) const override;
 	virtual bool BoundingBox(Float time0, Float time1, AABB& outputBox) const override;
+	virtual std::shared_ptr<Material> GetMaterial() const override { return material; }
+	virtual Float Area() const override {
+		const Point3f &p0 = mesh->vertices[vertexIndices[0]];
+		return 0.5f * Cross(mesh->vertices[vertexIndices[1]] - p0, mesh->vertices[vertexIndices[2]] - p0).Length();
+	}
+	virtual Float PDFValue(const Point3f& o, const Vector3f& v) const override {
+		IntersectionRecord rec;
+		if (!this->Intersection(Ray(o, v), 0.001, Infinity, rec))
+			return 0;
+
+		auto distanceSquared = rec.time * rec.time * v.LengthSquared();
+		auto cosine = fabs(Dot(v, rec.normal) / v.Length());
+
+		return distanceSquared / (cosine * Area());
+	}
+	//uniform over the area: the square root warps u.x so the barycentrics do not bunch at p0
+	virtual Vector3f ShapeRandom(const Point3f& o, const Point2f& u) const override {
+		auto su = std::sqrt(u.x);
+		auto b1 = u.y * su, b2 = 1 - su;
+		const Point3f &p0 = mesh->vertices[vertexIndices[0]];
+		auto randomPoint = p0 + b1 * (mesh->vertices[vertexIndices[1]] - p0) + b2 * (mesh->vertices[vertexIndices[2]] - p0);
+		return randomPoint - o;
+	}
+	using Shape::ShapeRandom;
+	virtual bool IsSamplable() const override { return true; }
 
 private:
 	void GetUV(Point2f uv[3]) const {
-		if (mesh->uvs) {
+		if (!mesh->uvs.empty()) {
 			uv[0] = mesh->uvs[vertexIndices[0]];
 			uv[1] = mesh->uvs[vertexIndices[1]];
 			uv[2] = mesh->uvs[vertexIndices[2]];
@@ -43,7 +68,7 @@ bool Triangle::BoundingBox(Float time0, Float time1, AABB& outputBox) const {
 }
 
 bool Triangle::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionRecord & rec) const {
-	float u, v;
+	Float u, v;
 	auto p0 = mesh->vertices[vertexIndices[0]];
 	auto p1 = mesh->vertices[vertexIndices[1]];
 	auto p2 = mesh->vertices[vertexIndices[2]];
@@ -52,11 +77,11 @@ bool Triangle::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionR
 	Vector3f s = r.origin - mesh->vertices[vertexIndices[0]];
 	Vector3f s1 = Cross(r.direction, e2);
 	Vector3f s2 = Cross(s, e1);
-	float coeff = 1.0 / Dot(s1, e1);
-	float t = coeff * Dot(s2, e2);
-	float b1 = coeff * Dot(s1, s);
-	float b2 = coeff * Dot(s2, r.direction);
-	if (t >= 0 && b1 >= 0 && b2 >= 0 && (1 - b1 - b2) >= 0){
+	Float coeff = 1 / Dot(s1, e1);
+	Float t = coeff * Dot(s2, e2);
+	Float b1 = coeff * Dot(s1, s);
+	Float b2 = coeff * Dot(s2, r.direction);
+	if (t >= tMin && t <= tMax && b1 >= 0 && b2 >= 0 && (1 - b1 - b2) >= 0){
 		u = b1;
 		v = b2;
 	}
@@ -79,6 +104,15 @@ bool Triangle::Intersection(const Ray & r, Float tMin, Float tMax, IntersectionR
 	// find the uv corresponding to point f (uv1/uv2/uv3 are associated to p1/p2/p3):
 	rec.u = a1 * uv[0].x + a2 * uv[1].x + a3 * uv[2].x;
 	rec.v = a1 * uv[0].y + a2 * uv[1].y + a3 * uv[2].y;
+	Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
+	Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
+	Float determinant = duv02.x * duv12.y - duv02.y * duv12.x;
+	if (std::abs(determinant) < 1e-9f) rec.dpdu = rec.dpdv = Vector3f();
+	else {
+		Float invDet = 1 / determinant;
+		rec.dpdu = (duv12.y * dp02 - duv02.y * dp12) * invDet;
+		rec.dpdv = (duv02.x * dp12 - duv12.x * dp02) * invDet;
+	}
 
 	//Point2f uv[3];
 	//